@@ -0,0 +1,145 @@
+// Intcode interpreter, instantiated by including this file with policies defined:
+//   ENGINE            name of the function to define
+//   ENGINE_ADD(x, y)  cell arithmetic for ADD,
+//   ENGINE_MUL(x, y)  and MUL: wrapping or checked
+//   ENGINE_STDIO      if defined, INP/OUT use stdin/stdout directly and never block or return;
+//                     else they use the VM's channels, or the shared fifo and return after OUT
+//   ENGINE_BREAK      if defined, stop before the instructions at the VM's breakpoints
+// Everything is resolved at compile time, so each instantiation is as fast as a hand-written one.
+// Memory is always the VirtualMachine.mem array, whatever backend grow() picked for it.
+
+#ifdef ENGINE_STDIO
+#define ENGINE_HOT()
+#else
+// image got hot: return so runengine() continues in the threaded engine
+#define ENGINE_HOT() do { if (pv->hotat && pv->ticks >= pv->hotat) { pv->hotat = 0; return; } } while (0)
+#endif
+
+static void ENGINE(VirtualMachine *pv)
+{
+    int64_t in, p[MAXPC], q;  // complete instruction, parameter values, temp param value
+    OpCode  op;               // opcode from instruction
+    ParMode mode;             // parameter mode for one parameter:
+    int pc;                   // running parameter count
+
+    if (interrupted(pv))
+        return;
+    while (!pv->halted) {
+        if (pv->limit && pv->ticks >= pv->limit)
+            return;
+        ++pv->ticks;
+        const ssize_t start = pv->ip;  // to retry instruction when blocked on I/O
+        interpip = start;              // for the profiler
+#ifdef ENGINE_BREAK
+        if (pv->trap != (size_t)start + 1 && isbreak(pv, (size_t)start)) {
+            pv->trap = (size_t)start + 1;  // stop at breakpoint, before the instruction
+            --pv->ticks;
+            return;
+        }
+        pv->trap = 0;  // resumed from breakpoint, or not at one
+#endif
+        if (pv->ip < 0)
+            fatal(ERR_IP_LO);
+        if ((size_t)(pv->ip) >= pv->size)
+            fatal(ERR_IP_HI);
+
+        in = pv->mem[pv->ip++];  // get instruction code, increment IP
+        op = in % 100;
+        const Lang *def = getdef(op);
+
+        if (def->pc > 0 && (size_t)(pv->ip + def->pc) >= pv->size)
+            fatal(ERR_IP_INSTR);
+
+        in /= 100;  // parameter modes for all parameters
+        pc = 0;     // param count
+        while (pc < def->ic) {
+            q = pv->mem[pv->ip++];  // get immediate parameter value, increment IP
+            mode = in % 10;         // mode for this parameter (0=positional, 1=immediate, 2=relative)
+            if (!(mode & IMM)) {    // if positional or relative
+                if (mode & REL)     // if relative
+                    q += pv->base;
+                if (q < 0)  // negative addresses are invalid
+                    fatal(ERR_PAR_READ);
+                if ((size_t)q >= pv->size)  // read beyond mem size?
+                    grow(pv, (size_t)q);
+                q = pv->mem[q];  // indirection for positional or relative parameter
+            }
+            p[pc++] = q;  // save & increment param count
+            in /= 10;     // modes for remaining parameters
+        }
+
+        if (def->oc) {  // output param always last, never more than one, never immediate
+            q = pv->mem[pv->ip++];  // get immediate parameter value, increment IP
+            mode = in % 10;         // mode for this parameter (0=positional, 1=immediate, 2=relative)
+            if (mode & REL)         // if relative
+                q += pv->base;
+            if (q < 0)  // negative addresses are invalid
+                fatal(ERR_PAR_WRITE);
+            if ((size_t)q >= pv->size)  // write beyond mem size?
+                grow(pv, (size_t)q);
+            p[pc++] = q;  // no indirection yet, use as index in mem
+        }
+
+        switch (op) {
+            case NOP: break;
+            case ADD: pv->mem[p[2]] = ENGINE_ADD(p[0], p[1]); break;
+            case MUL: pv->mem[p[2]] = ENGINE_MUL(p[0], p[1]); break;
+#ifdef ENGINE_STDIO
+            case INP: pv->mem[p[0]] = input(); break;
+            case OUT: output(p[0]);            break;
+#else
+            case INP:
+                if (pv->in == NULL)
+                    pv->mem[p[0]] = fifo_pop();  // when fifo empty, ask
+                else if (!dequeue(pv->in, &pv->mem[p[0]])) {
+                    pv->ip = start;  // blocked on empty channel
+                    --pv->ticks;
+                    return;
+                }
+                break;
+            case OUT:
+                if (pv->out == NULL) {
+                    fifo_push(p[0]);  // shared fifo, return so the caller can pass it on
+                    return;
+                }
+                if (!enqueue(pv->out, p[0])) {
+                    pv->ip = start;  // blocked on full channel
+                    --pv->ticks;
+                    return;
+                }
+                break;
+#endif
+            case JNZ:
+                if (p[0]) {
+                    pv->ip = p[1];
+                    if (interrupted(pv))  // block boundary
+                        return;
+                    if (pv->natcount)  // recognised subroutine?
+                        callnative(pv);
+                    ENGINE_HOT();
+                }
+                break;
+            case JPZ:
+                if (!p[0]) {
+                    pv->ip = p[1];
+                    if (interrupted(pv))  // block boundary
+                        return;
+                    if (pv->natcount)  // recognised subroutine?
+                        callnative(pv);
+                    ENGINE_HOT();
+                }
+                break;
+            case LT : pv->mem[p[2]] = p[0] <  p[1]; break;
+            case EQ : pv->mem[p[2]] = p[0] == p[1]; break;
+            case RBO: pv->base += p[0];             break;
+            case HLT: pv->halted = true;            break;
+        }
+    }
+}
+
+#undef ENGINE
+#undef ENGINE_ADD
+#undef ENGINE_MUL
+#undef ENGINE_STDIO
+#undef ENGINE_BREAK
+#undef ENGINE_HOT
@@ -1,14 +1,48 @@
+#define _GNU_SOURCE  // mremap
 #include <stdio.h>     // (f)printf, fscanf, fgetc, fgets
 #include <stdlib.h>    // malloc, free, atoi
 #include <stdint.h>    // int64_t
 #include <inttypes.h>  // PRId64
 #include <string.h>    // memcpy, getline
-#include <unistd.h>    // isatty, STDIN_FILENO
+#include <unistd.h>    // isatty, STDIN_FILENO, fork, pipe, read, write, close, _exit
 #include <stdbool.h>   // bool
+#include <signal.h>    // kill, SIGTERM
+#include <sys/wait.h>  // waitpid
+#include <stdatomic.h> // atomic_int, atomic_load_explicit, atomic_store_explicit
+#include <sys/time.h>  // setitimer, ITIMER_PROF
+#include <time.h>      // clock_gettime, CLOCK_MONOTONIC, time
+#include <math.h>      // sqrt
+#include <sys/utsname.h>  // uname
+#include <sys/mman.h>  // mmap, mremap, munmap, madvise
+#include <sys/stat.h>  // fstat, mkdir
+#include <fcntl.h>     // open
+#include <errno.h>     // errno
 
 #define MAXPC   (3)  // max param count
+#define MAXBRK  (8)  // max breakpoints per VM
+#define MAXSNAP (16) // max checkpoints kept for reverse execution
+#define MAXIMAGE (8) // max interned program images
+#define MAXNODES (256)  // max snapshots in the input-prefix trie (serve mode)
+#define MAXCELL ((int64_t)1 << 32)  // addresses a serve request may patch or query
+#define MAXNAT  (4)  // max recognised subroutines per VM
+#define FRAMES  (16)  // call depth assumed for the stack when estimating memory use
+#define REACH   (16)  // addresses beyond REACH * program size are left to the growth path
+#define GROWMAX (4)   // reallocs of a flat memory before switching to geometric growth
+#define SPARSE  (1 << 20)  // min address (in cells) that may switch a VM to mapped memory
+#define HUGEPAGE (1 << 21) // min mapping (in bytes) to ask for transparent huge pages
+#define SELFMOD  (8)    // interpret programs where more than 1 in SELFMOD instructions writes to code
+#define IODENSE  (4)    // interpret programs where more than 1 in IODENSE instructions is I/O
+#define AMORTISE (8)    // interpreted instructions per program cell before decoding it
+#define MAXSAMPLE (1 << 16)  // max profiler samples
+#define BENCHRUNS (20)       // timed samples per benchmark
+#define BENCHMIN  (10000000) // min duration of one sample in ns (10 ms)
+#define BENCHMARGIN (1.05)   // min ratio to the baseline for a slowdown
+#define BENCHLOG  "bench_history.txt"   // every benchmark result is appended here
+#define BENCHBASE "bench_baseline.txt"  // results to compare against
 #define STAGES  (5)  // number of amplifier stages (day 7)
 #define VMCOUNT (STAGES + 1)  // maximum number of VMs
+#define SWEEP   (100)  // noun and verb range for the parameter sweep (day 2)
+#define WORKERS (4)    // worker processes for the parameter sweep
 
 typedef enum errcode {
     ERR_OK,
@@ -21,6 +55,9 @@ typedef enum errcode {
     ERR_IP_INSTR,
     ERR_PAR_READ,
     ERR_PAR_WRITE,
+    ERR_OVERFLOW,
+    ERR_NATIVE,
+    ERR_ENGINE,
 } ErrCode;
 
 typedef enum parmode {
@@ -54,18 +91,105 @@ static const Lang lang[] = {
 };
 static const size_t langsize = sizeof lang / sizeof *lang;
 
+#define FIFOSIZE (100)
+#define LATSUB   (4)  // sub-buckets per power of two in latency histograms (HDR-style)
+#define LATBINS  (64 * LATSUB)
+
+// Latency histogram in nanoseconds
+typedef struct histogram {
+    uint64_t count[LATBINS];
+    uint64_t total, max;
+} Histogram;
+
+// Requests from the host to a VM, may be made while it runs
+typedef enum control {
+    CTL_RUN, CTL_PAUSE, CTL_KILL
+} Control;
+
+typedef struct native {
+    size_t addr;   // entry point of a recognised subroutine
+    size_t which;  // index in intrinsic[]
+} Native;
+
+typedef struct fifo {
+    int64_t buf[FIFOSIZE];
+    size_t head, tail;
+    uint64_t stamp[FIFOSIZE];  // enqueue times, only kept when there is a histogram
+    Histogram *lat;            // time from enqueue to dequeue, or NULL
+} Fifo;
+
+// Memory backend, chosen per VM by grow() from how the program addresses memory
+typedef enum memback {
+    MEM_FLAT,  // exact size, realloc on every growth: programs that stay within the static bound
+    MEM_GROW,  // geometric growth: programs whose stack keeps creeping past the bound
+    MEM_MAP,   // anonymous mapping, pages zeroed lazily by the OS: sparse far addresses
+} MemBack;
+
+static const char *memname[] = { "flat", "grow", "map" };
+
+// Execution engine, chosen per program by pickengine() or on the command line
+typedef enum engine {
+    ENG_AUTO,      // let pickengine() decide
+    ENG_INTERP,    // reference interpreter, engine.h
+    ENG_THREADED,  // pre-decoded instructions, one specialised handler per opcode and modes
+    ENG_IMAGE,     // compiled with cgen and built in with -DIMAGE
+} Engine;
+
+static const char *engname[] = { "auto", "interp", "threaded", "image" };
+static Engine engine = ENG_AUTO;  // command line override
+
+// Pre-decoded instruction for the threaded engine, valid while the cell still holds 'in'
+typedef struct decoded {
+    int64_t in;     // instruction cell it was decoded from
+    uint32_t kind;  // handler, see KIND()
+    uint32_t addr;  // where it is in memory
+} Decoded;
+
 typedef struct virtualmachine {
     int64_t *mem;
     size_t size;
+    MemBack back;
+    size_t grows;  // growth events during execution
     ssize_t ip, base;
     bool halted;
+    Fifo *in, *out;  // private I/O channels, or NULL for the shared fifo
+    atomic_int ctl;  // Control, checked by run() on entry and at every taken jump
+    size_t brk[MAXBRK];  // addresses of instructions to stop at, see setbreak()
+    size_t brkcount;
+    size_t trap;  // 1 + address of the breakpoint the VM stopped at, 0 if none
+    uint64_t ticks, limit;  // instructions executed, run() returns when reaching limit (0 = no limit)
+    uint64_t hotat;  // ticks at which the interpreter returns to switch engines (0 = never), cleared when it does
+    bool checked;  // fail on arithmetic overflow instead of wrapping
+    Native nat[MAXNAT];
+    size_t natcount;
+    Engine eng;
+    struct image *img;  // program image it was loaded from, or NULL
 } VirtualMachine;
 
+// Program image, shared by all loads of the same file contents
+typedef struct image {
+    uint64_t hash;  // of the file contents
+    size_t bytes;   // file length
+    int64_t *mem;
+    size_t size;
+    uint64_t ticks;  // instructions interpreted by all VMs running it
+    Engine eng;      // threadable() verdict, ENG_AUTO until it has been swept
+    Decoded *dec;    // decoded when hot, for the threaded engine: instructions only, in address order
+    size_t declen;   // instructions in dec
+    uint32_t *at;    // 1 + index in dec for every program address, 0 if not in dec; follows dec
+    void *map;       // cache file mapping that dec points into, or NULL if dec was allocated
+    size_t mapped;   // bytes mapped
+} Image;
+
 static VirtualMachine vm[VMCOUNT] = {0};
+static Image images[MAXIMAGE] = {0};
+static size_t imagecount = 0;
+static VirtualMachine spec[STAGES] = {0};  // speculative branches, one per predicted input (day 7 phases)
 
-#define FIFOSIZE (100)
-static int64_t fifobuf[FIFOSIZE] = {0};
-static size_t fifohead = 0, fifotail = 0;
+static Fifo fifo = {0};  // shared I/O, falls back to stdin/stdout
+static Fifo inbox[STAGES] = {0}, outbox[STAGES] = {0};  // amplifier network (day 7)
+static Fifo specout[STAGES] = {0};  // outputs of the speculative branches
+static Histogram fifolat = {0}, inlat[STAGES] = {0}, outlat[STAGES] = {0};  // channel latencies
 
 // Get number from stdin, either piped or on terminal
 static int64_t input(void)
@@ -87,28 +211,108 @@ static void output(const int64_t val)
     printf("%"PRId64"\n", val);
 }
 
+static uint64_t nanotime(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
+
+// Histogram bin: exact below LATSUB, else LATSUB bins per power of two
+static size_t latbin(const uint64_t ns)
+{
+    if (ns < LATSUB)
+        return ns;
+    const int msb = 63 - __builtin_clzll(ns);
+    return (size_t)msb * LATSUB + ((ns >> (msb - 2)) & (LATSUB - 1));
+}
+
+// Lowest value in histogram bin
+static uint64_t latval(const size_t bin)
+{
+    if (bin < LATSUB)
+        return bin;
+    return (uint64_t)(LATSUB + bin % LATSUB) << (bin / LATSUB - 2);
+}
+
+static void latadd(Histogram *h, const uint64_t ns)
+{
+    h->count[latbin(ns)]++;
+    h->total++;
+    if (ns > h->max)
+        h->max = ns;
+}
+
+// Value below which fraction q of the measurements fall (to histogram precision)
+static uint64_t percentile(const Histogram *h, const double q)
+{
+    uint64_t n = 0;
+    for (size_t i = 0; i < LATBINS; ++i)
+        if ((n += h->count[i]) >= q * h->total)
+            return latval(i);
+    return h->max;
+}
+
+static void latprint(FILE *f, const char *name, const Histogram *h)
+{
+    if (!h->total)
+        return;
+    fprintf(f, "%-10s %10"PRIu64" p50=%"PRIu64" p90=%"PRIu64" p99=%"PRIu64" p99.9=%"PRIu64" max=%"PRIu64" ns\n", name, h->total,
+        percentile(h, 0.5), percentile(h, 0.9), percentile(h, 0.99), percentile(h, 0.999), h->max);
+}
+
+// Empty channel, keep its histogram
+static void reset(Fifo *f)
+{
+    f->head = f->tail = 0;
+}
+
+static bool isfull(const Fifo *f)
+{
+    return (f->head + 1) % FIFOSIZE == f->tail;
+}
+
+// Take value from channel, return false if empty
+static bool dequeue(Fifo *f, int64_t *val)
+{
+    if (f->head == f->tail)
+        return false;
+    if (f->lat != NULL)
+        latadd(f->lat, nanotime() - f->stamp[f->tail]);
+    *val = f->buf[f->tail++];
+    f->tail %= FIFOSIZE;
+    return true;
+}
+
+// Add value to channel, return false if full
+static bool enqueue(Fifo *f, const int64_t val)
+{
+    if (isfull(f))
+        return false;
+    if (f->lat != NULL)
+        f->stamp[f->head] = nanotime();
+    f->buf[f->head++] = val;
+    f->head %= FIFOSIZE;
+    return true;
+}
+
 static int64_t fifo_pop(void)
 {
-    if (fifohead == fifotail) {
+    int64_t val;
+    if (!dequeue(&fifo, &val))
         return input();
-    }
-    int64_t val = fifobuf[fifotail++];
-    fifotail %= FIFOSIZE;
     return val;
 }
 
 static void fifo_push(const int64_t val)
 {
-    size_t nexthead = (fifohead + 1) % FIFOSIZE;
-    if (nexthead == fifotail)
+    if (!enqueue(&fifo, val))
         output(val);
-    fifobuf[fifohead] = val;
-    fifohead = nexthead;
 }
 
 static void fifoprint()
 {
-    while (fifohead != fifotail)
+    while (fifo.head != fifo.tail)
         output(fifo_pop());
 }
 
@@ -127,15 +331,99 @@ static const Lang *getdef(OpCode op)
 static void clean(VirtualMachine *pv)
 {
     if (pv != NULL) {
-        free(pv->mem);
+        if (pv->back == MEM_MAP)
+            munmap(pv->mem, pv->size * sizeof *(pv->mem));
+        else
+            free(pv->mem);
         *pv = (VirtualMachine){0};
     }
 }
 
+// FNV-1a hash
+static uint64_t fnv1a(const char *s, const size_t len)
+{
+    uint64_t h = 14695981039346656037u;
+    for (size_t i = 0; i < len; ++i)
+        h = (h ^ (unsigned char)s[i]) * 1099511628211u;
+    return h;
+}
+
+static void forgetimages(void)
+{
+    for (size_t i = 0; i < imagecount; ++i) {
+        free(images[i].mem);
+        if (images[i].map != NULL)
+            munmap(images[i].map, images[i].mapped);
+        else
+            free(images[i].dec);
+    }
+    imagecount = 0;
+    for (size_t i = 0; i < VMCOUNT; ++i)  // VMs can still interpret
+        vm[i].img = NULL;
+    for (size_t i = 0; i < STAGES; ++i)
+        spec[i].img = NULL;
+}
+
+// Optional timeline of VM events in Chrome trace format, for chrome://tracing or
+// Perfetto: one track per VM with its runs, why each run ended, and engine and
+// memory changes. Events are only written at run() boundaries, so with tracing
+// off the cost is a pointer test per run.
+static FILE *trace = NULL;
+static uint64_t tracestart;
+
+// Track of a VM: its index in vm[], then spec[], then one track for all others
+static int traceid(const VirtualMachine *pv)
+{
+    if (pv >= vm && pv < vm + VMCOUNT)
+        return (int)(pv - vm);
+    if (pv >= spec && pv < spec + STAGES)
+        return VMCOUNT + (int)(pv - spec);
+    return VMCOUNT + STAGES;
+}
+
+// One event: ph "X" is a complete event from t0 to t1, "i" an instant at t0
+static void traceevent(const VirtualMachine *pv, const char *ph, const char *name, const uint64_t t0, const uint64_t t1)
+{
+    fprintf(trace, ",\n{\"name\":\"%s\",\"ph\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f", name, ph, (int)getpid(), traceid(pv),
+        (double)(t0 - tracestart) / 1000);
+    if (*ph == 'X')
+        fprintf(trace, ",\"dur\":%.3f,\"args\":{\"ip\":%zd,\"ticks\":%"PRIu64"}", (double)(t1 - t0) / 1000, pv->ip, pv->ticks);
+    else
+        fprintf(trace, ",\"s\":\"t\"");
+    fprintf(trace, "}");
+}
+
+static void traceopen(const char *filename)
+{
+    if ((trace = fopen(filename, "w")) == NULL)
+        return;
+    tracestart = nanotime();
+    fprintf(trace, "[{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"intcode\"}}", (int)getpid());
+    for (int i = 0; i <= VMCOUNT + STAGES; ++i) {
+        char name[16] = "other";  // the last track, for all VMs that don't have their own
+        if (i < VMCOUNT + STAGES)
+            snprintf(name, sizeof name, "%s%d", i < VMCOUNT ? "vm" : "spec", i < VMCOUNT ? i : i - VMCOUNT);
+        fprintf(trace, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", (int)getpid(), i, name);
+    }
+}
+
+static void tracedone(void)
+{
+    if (trace != NULL) {
+        fprintf(trace, "\n]\n");
+        fclose(trace);
+        trace = NULL;
+    }
+}
+
 static void clean_all(void)
 {
     for (size_t i = 0; i < VMCOUNT; ++i)
         clean(&vm[i]);
+    for (size_t i = 0; i < STAGES; ++i)
+        clean(&spec[i]);
+    forgetimages();
+    tracedone();
 }
 
 static __attribute__((noreturn)) void fatal(ErrCode e)
@@ -151,14 +439,33 @@ static __attribute__((noreturn)) void fatal(ErrCode e)
         case ERR_IP_INSTR      : fprintf(stderr, "Instr segfault.\n");       break;
         case ERR_PAR_READ      : fprintf(stderr, "Par segfault (read).\n");  break;
         case ERR_PAR_WRITE     : fprintf(stderr, "Par segfault (write).\n"); break;
+        case ERR_OVERFLOW      : fprintf(stderr, "Arithmetic overflow.\n");  break;
+        case ERR_NATIVE        : fprintf(stderr, "Intrinsic mismatch.\n");   break;
+        case ERR_ENGINE        : fprintf(stderr, "Unknown engine.\n");       break;
     }
     clean_all();
     exit((int)e);
 }
 
+// Mapping length in bytes for a memory size in cells, whole pages
+static size_t mapbytes(const size_t cells)
+{
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (cells * sizeof(int64_t) + page - 1) / page * page;
+}
+
 static void setsize(VirtualMachine *pv, const size_t newsize)
 {
-    if (pv != NULL && newsize > pv->size) {
+    if (pv != NULL && newsize > pv->size && pv->back == MEM_MAP) {
+        const size_t bytes = mapbytes(newsize);  // new pages are zero
+        void *try = mremap(pv->mem, pv->size * sizeof *(pv->mem), bytes, MREMAP_MAYMOVE);
+        if (try == MAP_FAILED)
+            fatal(ERR_MEM_OUT);
+        if (bytes >= HUGEPAGE)
+            madvise(try, bytes, MADV_HUGEPAGE);
+        pv->mem = try;
+        pv->size = bytes / sizeof *(pv->mem);
+    } else if (pv != NULL && newsize > pv->size) {
         int64_t *try = realloc(pv->mem, newsize * sizeof *(pv->mem));
         if (try == NULL) {
             fatal(ERR_MEM_OUT);
@@ -169,56 +476,325 @@ static void setsize(VirtualMachine *pv, const size_t newsize)
     }
 }
 
+// Fresh mapping of at least cells, zeroed lazily by the OS; sets *size to the cells mapped
+static int64_t *newmap(const size_t cells, size_t *size)
+{
+    const size_t bytes = mapbytes(cells ? cells : 1);
+    int64_t *try = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (try == MAP_FAILED)
+        fatal(ERR_MEM_OUT);
+    if (bytes >= HUGEPAGE)
+        madvise(try, bytes, MADV_HUGEPAGE);
+    *size = bytes / sizeof *try;
+    return try;
+}
+
+// Memory migrations by target backend, reported with INTCODE_STATS
+static struct {
+    uint64_t count, ns;
+} migstat[sizeof memname / sizeof *memname];
+
+// Move VM memory to another backend, same size and contents
+static void migrate(VirtualMachine *pv, const MemBack back)
+{
+    const uint64_t t0 = nanotime();
+    if (back == MEM_MAP) {
+        size_t size;
+        int64_t *try = newmap(pv->size, &size);
+        memcpy(try, pv->mem, pv->size * sizeof *(pv->mem));
+        free(pv->mem);
+        pv->mem = try;
+        pv->size = size;
+    }
+    pv->back = back;
+    migstat[back].count++;
+    migstat[back].ns += nanotime() - t0;
+    if (trace != NULL)
+        traceevent(pv, "i", back == MEM_MAP ? "memory: map" : "memory: grow", t0, 0);
+}
+
+// Grow memory of a running VM to include addr. A far jump in addresses means
+// sparse use, which mapped memory handles without touching the gap; repeated
+// small steps mean a creeping stack, which geometric growth handles in log time.
+static void grow(VirtualMachine *pv, const size_t addr)
+{
+    ++pv->grows;
+    if (pv->back != MEM_MAP && addr >= SPARSE && addr / 4 > pv->size)
+        migrate(pv, MEM_MAP);
+    else if (pv->back == MEM_FLAT && pv->grows > GROWMAX)
+        migrate(pv, MEM_GROW);
+    setsize(pv, pv->back == MEM_GROW && addr < pv->size * 2 ? pv->size * 2 : addr + 1);
+}
+
+static void memprint(FILE *f)
+{
+    for (size_t i = 0; i < sizeof memname / sizeof *memname; ++i)
+        if (migstat[i].count)
+            fprintf(f, "mem.%-6s %10"PRIu64" migrations, %"PRIu64" ns\n", memname[i], migstat[i].count, migstat[i].ns);
+}
+
 static void addsize(VirtualMachine *pv, const ssize_t extra)
 {
     if (pv != NULL && extra > 0)
         setsize(pv, pv->size + (size_t)extra);
 }
 
+// Ask VM to stop at the next block boundary; it can then be inspected, copied and
+// resumed. Lock-free, so safe to call from another thread or a signal handler.
+static void pausevm(VirtualMachine *pv)
+{
+    atomic_store_explicit(&pv->ctl, CTL_PAUSE, memory_order_release);
+}
+
+// Ask VM to halt at the next block boundary
+static void killvm(VirtualMachine *pv)
+{
+    atomic_store_explicit(&pv->ctl, CTL_KILL, memory_order_release);
+}
+
+// Allow a paused VM to run again
+static void resumevm(VirtualMachine *pv)
+{
+    atomic_store_explicit(&pv->ctl, CTL_RUN, memory_order_release);
+}
+
+// Copy memory to dst on the backend of src. Mapped memory is never erased or
+// copied whole: dst gets a fresh mapping and only the pages of src that aren't
+// all zero, so the untouched part of a sparse range stays untouched.
+static void copymem(VirtualMachine *dst, const VirtualMachine *src)
+{
+    if (dst->back == MEM_MAP || src->back == MEM_MAP) {
+        if (dst->back == MEM_MAP)
+            munmap(dst->mem, dst->size * sizeof *(dst->mem));
+        else
+            free(dst->mem);
+        dst->mem = NULL;
+        dst->size = 0;
+    }
+    dst->back = src->back;
+    if (src->back == MEM_MAP) {
+        static const int64_t zero[512];  // 4 KB
+        const size_t page = sizeof zero / sizeof *zero;
+        dst->mem = newmap(src->size, &dst->size);
+        for (size_t i = 0; i < src->size; i += page) {
+            const size_t n = src->size - i < page ? src->size - i : page;
+            if (memcmp(src->mem + i, zero, n * sizeof *(src->mem)))
+                memcpy(dst->mem + i, src->mem + i, n * sizeof *(src->mem));
+        }
+        return;
+    }
+    setsize(dst, src->size);  // new minimal size (could still be bigger as a left-over)
+    memcpy(dst->mem, src->mem, src->size * sizeof *(src->mem));  // copy memory from source
+    if (dst->size > src->size)  // erase the rest
+        memset(dst->mem + src->size, 0, (dst->size - src->size) * sizeof *(dst->mem));
+}
+
 static void copyvm(VirtualMachine *dst, const VirtualMachine *src)
 {
     if (dst != NULL && src != NULL) {
-        setsize(dst, src->size);  // new minimal size (could still be bigger as a left-over)
-        memcpy(dst->mem, src->mem, src->size * sizeof *(src->mem));  // copy memory from source
-        if (dst->size > src->size)  // erase the rest
-            memset(dst->mem + src->size, 0, (dst->size - src->size) * sizeof *(dst->mem));
+        copymem(dst, src);
+        dst->grows  = src->grows;  // growth of this run, not of earlier ones in dst
         dst->ip     = src->ip;
         dst->base   = src->base;
         dst->halted = src->halted;
+        resumevm(dst);  // requests were for the VM it was before
+        memcpy(dst->brk, src->brk, src->brkcount * sizeof *(src->brk));
+        dst->brkcount = src->brkcount;
+        dst->trap     = src->trap;
+        dst->ticks    = src->ticks;
+        memcpy(dst->nat, src->nat, src->natcount * sizeof *(src->nat));
+        dst->natcount = src->natcount;
+        dst->eng      = src->eng;
+        dst->img      = src->img;
     }
 }
 
-static void load(VirtualMachine *pv, const char *filename)
+// Memory cell for a positional or relative parameter, grow memory if needed
+static int64_t *cell(VirtualMachine *pv, const int64_t addr, const ErrCode e)
+{
+    if (addr < 0)
+        fatal(e);
+    if ((size_t)addr >= pv->size)
+        grow(pv, (size_t)addr);
+    return &pv->mem[addr];
+}
+
+// Arithmetic policies for the engines: wrapping like the hardware (signed
+// overflow is undefined behaviour in C), or fail on overflow
+#define WRAPADD(x, y) ((int64_t)((uint64_t)(x) + (uint64_t)(y)))
+#define WRAPMUL(x, y) ((int64_t)((uint64_t)(x) * (uint64_t)(y)))
+
+#ifdef IMAGE
+// Build with -DIMAGE='"image.h"' to embed a program image generated by "intcode cgen"
+// Its imagerun() executes the program as specialised C code, see run()
+typedef enum imageexit {
+    IMG_NONE,  // VM doesn't run this image, use the interpreter
+    IMG_STEP,  // instruction not compiled (I/O, modified code): interpreter executes one
+    IMG_DONE,  // run() should return
+} ImageExit;
+
+static bool interrupted(VirtualMachine *pv);
+static void callnative(VirtualMachine *pv);
+
+#include IMAGE
+#endif
+
+// Load program from file into VM (without recognising subroutines, see load())
+// Returns the interned image, or NULL if it wasn't interned
+static Image *readimage(VirtualMachine *pv, const char *filename)
 {
-    // Open file
+#ifdef IMAGE
+    if (!strcmp(filename, IMAGEFILE)) {
+        clean(pv);
+        setsize(pv, IMAGESIZE);
+        memcpy(pv->mem, image, sizeof image);
+        return NULL;
+    }
+#endif
+    // Read whole file
     FILE *f = fopen(filename, "r");
     if (f == NULL)
         fatal(ERR_FILE_NOTFOUND);
+    fseek(f, 0, SEEK_END);
+    const long bytes = ftell(f);
+    rewind(f);
+    char *buf = bytes >= 0 ? malloc((size_t)bytes + 1) : NULL;
+    if (buf == NULL) {
+        fclose(f);
+        fatal(ERR_MEM_OUT);
+    }
+    const size_t len = fread(buf, 1, (size_t)bytes, f);
+    buf[len] = '\0';
+    fclose(f);
+
+    // Same program loaded before?
+    const uint64_t hash = fnv1a(buf, len);
+    for (size_t i = 0; i < imagecount; ++i)
+        if (images[i].hash == hash && images[i].bytes == len) {
+            free(buf);
+            clean(pv);
+            setsize(pv, images[i].size);
+            memcpy(pv->mem, images[i].mem, images[i].size * sizeof *(pv->mem));
+            return &images[i];
+        }
 
     // Check number of commas
     size_t commas = 0;
-    int c;
-    while ((c = fgetc(f)) != EOF)
-        commas += c == ',';
-    if (!commas)
+    for (size_t i = 0; i < len; ++i)
+        commas += buf[i] == ',';
+    if (!commas) {
         // TODO: single number "99" or even "0" should probably be a valid file
+        free(buf);
         fatal(ERR_FILE_NOTCSV);
+    }
 
     // Prepare VM & memory
     clean(pv); // reset everything to zero
     setsize(pv, commas + 1);
 
-    // Read file into VM memory
-    rewind(f);
-    int n;
+    // Parse into VM memory
+    char *s = buf, *end;
     size_t i = 0;
-    if (fscanf(f, "%d", &n) == 1)  // first value has no leading comma
-        pv->mem[i++] = n;
-    while (i < pv->size && fscanf(f, ",%d", &n) == 1)  // all other values
+    while (i < pv->size) {
+        if (i && *s++ != ',')  // all other values have a leading comma
+            break;
+        const int64_t n = strtoll(s, &end, 10);
+        if (end == s)
+            break;
         pv->mem[i++] = n;
-    fclose(f);
+        s = end;
+    }
+    free(buf);
     if (i != pv->size)
         fatal(ERR_FILE_INVALID);
+
+    // Keep a copy for the next time
+    if (imagecount < MAXIMAGE) {
+        int64_t *mem = malloc(pv->size * sizeof *mem);
+        if (mem != NULL) {
+            memcpy(mem, pv->mem, pv->size * sizeof *mem);
+            images[imagecount] = (Image){ .hash = hash, .bytes = len, .mem = mem, .size = pv->size };
+            return &images[imagecount++];
+        }
+    }
+    return NULL;
+}
+
+// Definition of the instruction at address a if the cell decodes as one: known
+// opcode, valid modes, no immediate write, all parameters in memory; else NULL
+static const Lang *instr(const int64_t *mem, const size_t size, const size_t a)
+{
+    const int64_t in = mem[a];
+    if (in <= 0)
+        return NULL;
+    const Lang *def = getdef(in % 100);
+    if ((def->op != in % 100 && in % 100 != HLT) || (def->pc > 0 && a + 1 + (size_t)def->pc >= size))
+        return NULL;
+    int64_t m = in / 100;
+    for (int k = 0; k < def->pc; ++k, m /= 10)
+        if (m % 10 > REL || (k >= def->ic && m % 10 == IMM))
+            return NULL;
+    return m ? NULL : def;
+}
+
+// addr isn't a parameter in a linear sweep over the instructions from address 0
+// Cells that don't decode (yet) are stepped over one at a time, so code that the
+// program writes before it runs it counts as instructions, data as well
+static bool codeat(const VirtualMachine *pv, const size_t addr)
+{
+    size_t a = 0;
+    while (a < addr) {
+        const Lang *def = instr(pv->mem, pv->size, a);
+        a += def != NULL ? 1 + (size_t)def->pc : 1;
+    }
+    return a == addr && a < pv->size;
+}
+
+// Static upper bound on the memory a program uses, from a linear sweep over its
+// instructions: the largest positional address, and for relative addresses the
+// first immediate relative base offset (stack setup) plus FRAMES times the largest
+// push, plus the largest relative offset. Data that happens to decode as an
+// instruction can only make the bound bigger, which is harmless up to a point;
+// values beyond that point are ignored.
+static size_t reach(const VirtualMachine *pv)
+{
+    const int64_t far = (int64_t)(REACH * pv->size);
+    int64_t hi = (int64_t)pv->size, base = -1, push = 0, rel = 0;
+    size_t a = 0;
+    while (a < pv->size) {
+        const Lang *def = instr(pv->mem, pv->size, a);
+        if (def == NULL) {
+            ++a;  // not an instruction
+            continue;
+        }
+        int64_t m = pv->mem[a] / 100;
+        for (int k = 0; k < def->pc; ++k, m /= 10) {
+            const int64_t q = pv->mem[a + 1 + (size_t)k];
+            switch (m % 10) {
+                case POS:
+                    if (q >= hi && q < far)
+                        hi = q + 1;
+                    break;
+                case IMM:
+                    if (def->op == RBO && q < far) {
+                        if (base < 0)
+                            base = q;
+                        else if (q > push)
+                            push = q;
+                    }
+                    break;
+                case REL:
+                    if (q > rel && q < far)
+                        rel = q;
+                    break;
+            }
+        }
+        a += 1 + (size_t)def->pc;
+    }
+    const int64_t stack = base + FRAMES * push + rel;
+    if (base >= 0 && stack >= hi && stack < far)
+        hi = stack + 1;
+    return (size_t)hi;
 }
 
 static void print(VirtualMachine *pv)
@@ -229,183 +805,2234 @@ static void print(VirtualMachine *pv)
     printf("\n");
 }
 
-static void run(VirtualMachine *pv)
+// Check for a stop request from the host, true if run() should return
+static bool interrupted(VirtualMachine *pv)
+{
+    switch (atomic_load_explicit(&pv->ctl, memory_order_acquire)) {
+        case CTL_RUN  : return false;
+        case CTL_PAUSE: return true;
+        case CTL_KILL : pv->halted = true; return true;
+    }
+    return false;
+}
+
+// Host has asked the VM to stop since it was last resumed or copied
+static bool stopped(const VirtualMachine *pv)
 {
-    int64_t in, p[MAXPC], q;  // complete instruction, parameter values, temp param value
-    OpCode  op;               // opcode from instruction
-    ParMode mode;             // parameter mode for one parameter:
-    int pc;                   // running parameter count
+    return atomic_load_explicit(&pv->ctl, memory_order_acquire) != CTL_RUN;
+}
 
-    while (!pv->halted) {
-        if (pv->ip < 0)
-            fatal(ERR_IP_LO);
-        if ((size_t)(pv->ip) >= pv->size)
-            fatal(ERR_IP_HI);
-
-        in = pv->mem[pv->ip++];  // get instruction code, increment IP
-        op = in % 100;
-        const Lang *def = getdef(op);
-
-        if (def->pc > 0 && (size_t)(pv->ip + def->pc) >= pv->size)
-            fatal(ERR_IP_INSTR);
-
-        in /= 100;  // parameter modes for all parameters
-        pc = 0;     // param count
-        while (pc < def->ic) {
-            q = pv->mem[pv->ip++];  // get immediate parameter value, increment IP
-            mode = in % 10;         // mode for this parameter (0=positional, 1=immediate, 2=relative)
-            if (!(mode & IMM)) {    // if positional or relative
-                if (mode & REL)     // if relative
-                    q += pv->base;
-                if (q < 0)  // negative addresses are invalid
-                    fatal(ERR_PAR_READ);
-                if ((size_t)q >= pv->size)  // read beyond mem size?
-                    setsize(pv, (size_t)(q + 1));
-                q = pv->mem[q];  // indirection for positional or relative parameter
-            }
-            p[pc++] = q;  // save & increment param count
-            in /= 10;     // modes for remaining parameters
-        }
+// Set breakpoint on the instruction at addr. Memory isn't patched, programs
+// read their own code; while a VM has breakpoints it runs on execute_break(),
+// the other engines don't check for them and stay as fast as without.
+// Returns false if there is no room or addr is out of range
+static bool setbreak(VirtualMachine *pv, const size_t addr)
+{
+    if (addr >= pv->size)
+        return false;
+    for (size_t i = 0; i < pv->brkcount; ++i)
+        if (pv->brk[i] == addr)
+            return true;
+    if (pv->brkcount == MAXBRK)
+        return false;
+    pv->brk[pv->brkcount++] = addr;
+    return true;
+}
 
-        if (def->oc) {  // output param always last, never more than one, never immediate
-            q = pv->mem[pv->ip++];  // get immediate parameter value, increment IP
-            mode = in % 10;         // mode for this parameter (0=positional, 1=immediate, 2=relative)
-            if (mode & REL)         // if relative
-                q += pv->base;
-            if (q < 0)  // negative addresses are invalid
-                fatal(ERR_PAR_WRITE);
-            if ((size_t)q >= pv->size)  // write beyond mem size?
-                setsize(pv, (size_t)(q + 1));
-            p[pc++] = q;  // no indirection yet, use as index in mem
+// Remove breakpoint at addr, if there is one
+static void clearbreak(VirtualMachine *pv, const size_t addr)
+{
+    for (size_t i = 0; i < pv->brkcount; ++i)
+        if (pv->brk[i] == addr) {
+            pv->brk[i] = pv->brk[--pv->brkcount];
+            return;
         }
+}
 
-        switch (op) {
-            case NOP: break;
-            case ADD: pv->mem[p[2]] = p[0] + p[1];  break;
-            case MUL: pv->mem[p[2]] = p[0] * p[1];  break;
-            case INP: pv->mem[p[0]] = fifo_pop();   break;   // when fifo empty, ask
-            case OUT: fifo_push(p[0]);              return;  // TODO: keep running? But needs separate in/out fifos :(
-            case JNZ: if ( p[0]) pv->ip = p[1];     break;
-            case JPZ: if (!p[0]) pv->ip = p[1];     break;
-            case LT : pv->mem[p[2]] = p[0] <  p[1]; break;
-            case EQ : pv->mem[p[2]] = p[0] == p[1]; break;
-            case RBO: pv->base += p[0];             break;
-            case HLT: pv->halted = true;            break;
-        }
+static bool isbreak(const VirtualMachine *pv, const size_t addr)
+{
+    for (size_t i = 0; i < pv->brkcount; ++i)
+        if (pv->brk[i] == addr)
+            return true;
+    return false;
+}
+
+static int64_t checkedadd(const int64_t x, const int64_t y)
+{
+    int64_t r;
+    if (__builtin_add_overflow(x, y, &r))
+        fatal(ERR_OVERFLOW);
+    return r;
+}
+
+static int64_t checkedmul(const int64_t x, const int64_t y)
+{
+    int64_t r;
+    if (__builtin_mul_overflow(x, y, &r))
+        fatal(ERR_OVERFLOW);
+    return r;
+}
+
+// Native implementations of recognised subroutines (intrinsics). When a jump
+// enters one, the engine runs the native version and continues at its return
+// address. Subroutines are recognised by a hash of their code, or for idioms
+// that can be anywhere in memory by a matcher, which is checked again on every
+// call, so modified code is interpreted as usual.
+typedef enum nativemode {
+    NAT_OFF, NAT_ON, NAT_VERIFY
+} NativeMode;
+
+static NativeMode nativemode = NAT_ON;  // NAT_VERIFY: compare every call with the interpreter
+
+typedef struct intrinsic {
+    const char *name;
+    uint64_t hash;   // cellhash() of the code
+    size_t len;      // code cells from the entry point
+    int64_t first;   // first cell, to skip hashing most addresses when scanning
+    int64_t frame;   // cells from the relative base up that belong to the caller, -1 for all memory
+    bool (*fn)(VirtualMachine *pv);  // execute call at pv->ip, false to decline
+    bool (*match)(const int64_t *mem, const size_t a);  // recognise code at a instead of hash and first
+} Intrinsic;
+
+// FNV-1a hash of memory cells, as 64-bit little-endian
+static uint64_t cellhash(const int64_t *mem, const size_t len)
+{
+    uint64_t h = 14695981039346656037u;
+    for (size_t i = 0; i < len; ++i)
+        for (int j = 0; j < 64; j += 8)
+            h = (h ^ (((uint64_t)mem[i] >> j) & 0xff)) * 1099511628211u;
+    return h;
+}
+
+// Day 9: a(n) = n < 3 ? n : a(n - 1) + a(n - 3), exponential when interpreted
+// Calling convention: return address in frame cell 0, argument in cell 1,
+// result in cell 1; cell 63 holds the last comparison, which is always true
+static bool rec13(VirtualMachine *pv)
+{
+    const int64_t b = pv->base;
+    if (b < 0 || (size_t)b + 1 >= pv->size || pv->size <= 63)
+        return false;
+    const int64_t n = pv->mem[b + 1];
+    int64_t x = 0, y = 1, z = 2;  // a(k - 3), a(k - 2), a(k - 1)
+    for (int64_t k = 3; k <= n; ++k) {
+        const int64_t t = pv->checked ? checkedadd(z, x) : WRAPADD(z, x);
+        x = y;
+        y = z;
+        z = t;
     }
+    pv->mem[b + 1] = n < 3 ? n : z;
+    pv->mem[63] = 1;
+    pv->ip = pv->mem[b];
+    return true;
 }
 
-// Permutate in lexicographic order, adapted from "perm1()"
-// at http://www.rosettacode.org/wiki/Permutations#version_4
-static int next_perm(int *a, int n)
+// Multiply by repeated addition, wherever it is: acc += x, cnt -= 1 while cnt != 0
+//   a:      1,acc,x,acc   or 1,x,acc,acc, with x immediate: 1001,acc,x,acc or 101,x,acc,acc
+//   a + 4:  1001,cnt,-1,cnt or 101,-1,cnt,cnt
+//   a + 8:  1005,cnt,a
+// All positional, the counter and accumulator apart from each other and from the
+// loop itself. Entered at a by the jump back after the first round.
+typedef struct mulloop {
+    int64_t acc, x, cnt;
+    bool imm;  // x is a value, not an address
+} MulLoop;
+
+static bool mulparse(const int64_t *mem, const size_t a, MulLoop *l)
 {
-	int k, l, t;
+    const int64_t *c = mem + a;
+    if ((c[0] == 1 || c[0] == 1001) && c[1] == c[3]) {
+        l->acc = c[1];
+        l->x   = c[2];
+    } else if ((c[0] == 1 || c[0] == 101) && c[2] == c[3]) {
+        l->acc = c[2];
+        l->x   = c[1];
+    } else
+        return false;
+    l->imm = c[0] != 1;
+    if (c[4] == 1001 && c[6] == -1 && c[5] == c[7])
+        l->cnt = c[5];
+    else if (c[4] == 101 && c[5] == -1 && c[6] == c[7])
+        l->cnt = c[6];
+    else
+        return false;
+    const int64_t end = (int64_t)a + 11;
+    return c[8] == 1005 && c[9] == l->cnt && c[10] == (int64_t)a
+        && l->acc >= 0 && l->cnt >= 0 && l->acc != l->cnt && (l->imm || (l->x >= 0 && l->x != l->acc && l->x != l->cnt))
+        && (l->acc < (int64_t)a || l->acc >= end) && (l->cnt < (int64_t)a || l->cnt >= end);
+}
 
-	for (k = n - 1; k && a[k - 1] >= a[k]; --k)
-        ;
-	if (!k--)
-        return 0;
-	for (l = n - 1; a[l] <= a[k]; l--)
-        ;
-    t = a[k]; a[k] = a[l]; a[l] = t;
-	for (k++, l = n - 1; l > k; l--, k++)
-        t = a[k]; a[k] = a[l]; a[l] = t;
-	return 1;
+static bool mulmatch(const int64_t *mem, const size_t a)
+{
+    MulLoop l;
+    return mulparse(mem, a, &l);
 }
 
-// Maximum amplification for different phase permutations
-// amp = VirtualMachines array of length STAGES
-static int64_t maxamp(int part)
+// acc += x * cnt in one go; declined for a counter that isn't positive (the loop
+// would run 2^64 times or more), for addresses beyond memory, and with checked
+// arithmetic on overflow, so that the interpreter fails where the loop does
+static bool mulloop(VirtualMachine *pv)
 {
-    int64_t amax = -1;
-    int phase[STAGES];
+    MulLoop l;
+    if (!mulparse(pv->mem, (size_t)pv->ip, &l) || (size_t)l.acc >= pv->size || (size_t)l.cnt >= pv->size
+        || (!l.imm && (size_t)l.x >= pv->size))
+        return false;
+    const int64_t x = l.imm ? l.x : pv->mem[l.x], n = pv->mem[l.cnt];
+    if (n <= 0)
+        return false;
+    int64_t r;
+    if (!pv->checked)
+        r = WRAPADD(pv->mem[l.acc], WRAPMUL(x, n));
+    else if (__builtin_mul_overflow(x, n, &r) || __builtin_add_overflow(pv->mem[l.acc], r, &r))
+        return false;
+    pv->mem[l.acc] = r;
+    pv->mem[l.cnt] = 0;
+    pv->ip += 11;
+    return true;
+}
 
-    // Initial phase numbers: 0-4 for part 1, 5-9 for part 2
-	for (int i = 0; i < STAGES; ++i)
-        phase[i] = STAGES * (part - 1) + i;
+static const Intrinsic intrinsic[] = {
+    { "rec13", 0x7ba3a68ff06dedb0u, 51, 109, 2, rec13, NULL },
+    { "mulloop", 0, 11, 0, -1, mulloop, mulmatch },
+};
+static const size_t intrinsics = sizeof intrinsic / sizeof *intrinsic;
 
-    // All permutations of phase array
-	do {
-        // Start every permutation with fresh amps
-        for (int i = 0; i < STAGES; ++i)
-            copyvm(&vm[i], &vm[STAGES]);
-        // First run requires two inputs for every stage
-        int64_t a = 0;
-        for (int i = 0; i < STAGES; ++i) {
-            fifo_push(phase[i]);
-            fifo_push(a);
-            run(&vm[i]);
-            a = fifo_pop();
-        }
-        if (part == 2) {
-            // Multiple runs until halted
-            fifo_push(a);
-            int i = 0;
-            while (!vm[i].halted) {
-                run(&vm[i++]);
-                i %= STAGES;
-            }
-            a = fifo_pop();
-        }
-        if (a > amax)
-            amax = a;
-	} while (next_perm(phase, STAGES));
-    return amax;
+// Intrinsic f is at address a in memory of size cells
+static bool recognised(const Intrinsic *f, const int64_t *mem, const size_t size, const size_t a)
+{
+    if (a + f->len > size)
+        return false;
+    if (f->match != NULL)
+        return f->match(mem, a);
+    return mem[a] == f->first && cellhash(&mem[a], f->len) == f->hash;
 }
 
-static int day2part2(VirtualMachine *app, VirtualMachine *ref)
+// Find recognised subroutines in VM memory
+static void natives(VirtualMachine *pv)
 {
-    static const int magic = 19690720;
-    for (int verb = 0; verb < 100; ++verb)
-        for (int noun = 0; noun < 100; ++noun) {
-            copyvm(app, ref);
-            app->mem[1] = noun;
-            app->mem[2] = verb;
-            run(app);
-            if (app->mem[0] == magic)
-                return noun * 100 + verb;
-        }
-    return -1;
+    pv->natcount = 0;
+    if (nativemode == NAT_OFF)
+        return;
+    for (size_t i = 0; i < intrinsics; ++i)
+        for (size_t a = 0; a + intrinsic[i].len <= pv->size && pv->natcount < MAXNAT; ++a)
+            if (recognised(&intrinsic[i], pv->mem, pv->size, a))
+                pv->nat[pv->natcount++] = (Native){ .addr = a, .which = i };
 }
 
-int main(void)
+// Handler of the threaded engine for an instruction and its parameter modes
+#define KIND(op, m0, m1, m2) (1 + ((op) == HLT ? 10 : (op)) * 27 + (m0) + 3 * (m1) + 9 * (m2))
+#define KINDS (1 + 11 * 27)
+
+// Handler for the instruction at address a, 0 if it's not one or it's I/O,
+// which may block or return and is left to the interpreter
+static uint32_t kind(const int64_t *mem, const size_t size, const size_t a)
 {
-    VirtualMachine *ref, *app;
+    const Lang *def = instr(mem, size, a);
+    if (def == NULL || def->op == INP || def->op == OUT)
+        return 0;
+    const int64_t m = mem[a] / 100;
+    return KIND(mem[a] % 100, m % 10, m / 10 % 10, m / 100 % 10);
+}
 
-    // Day 2 part 1
-    ref = &vm[0];
-    app = &vm[1];
-    load(ref, "input02.txt");  // load data into last VM, amps are numbered 0..STAGES-1
-    copyvm(app, ref);
-    app->mem[1] = 12;
-    app->mem[2] = 2;
-    run(app);
-    printf("Day 2 part 1: %"PRId64"\n", app->mem[0]);  // right answer = 3085697
+// Decode an image for the threaded engine. Code and data are kept apart: the
+// instructions form a compact stream that the engine walks in order, and only
+// jumps go through the address index. Data stays in VM memory. The stream
+// starts with the instructions of a linear sweep, so that falling through is
+// the next entry; cells that only decode as an instruction when jumped into
+// come after. Stream and index are one allocation, laid out as in the cache
+// file. False if out of memory.
+static bool decodeall(Image *img)
+{
+    if (img->size > UINT32_MAX)
+        return false;
+    size_t n = 0;
+    for (size_t a = 0; a < img->size; ++a)
+        n += kind(img->mem, img->size, a) != 0;
+    Decoded *dec = calloc(1, n * sizeof *dec + img->size * sizeof *(img->at));  // zero padding, for the cache file
+    if (dec == NULL)
+        return false;
+    uint32_t *at = (uint32_t *)(dec + n);
+    n = 0;
+    for (int pass = 0; pass < 2; ++pass)
+        for (size_t a = 0; a < img->size; ) {
+            const Lang *def = instr(img->mem, img->size, a);
+            const uint32_t k = kind(img->mem, img->size, a);
+            if (k && !at[a]) {
+                dec[n].in = img->mem[a];
+                dec[n].kind = k;
+                dec[n].addr = (uint32_t)a;
+                at[a] = (uint32_t)++n;
+            }
+            a += pass == 0 && def != NULL ? 1 + (size_t)def->pc : 1;
+        }
+    img->dec = dec;
+    img->declen = n;
+    img->at = at;
+    return true;
+}
 
-    // Day 2 part 2
-    printf("Day 2 part 2: %d\n", day2part2(app, ref));  // right answer = 9425
+// Persistent cache of decoded tables, one file per program and table version
+// in the directory named by INTCODE_CACHE: a header, the instruction stream, the address index
+#define DECODEVER  (3)  // bump when Decoded, KIND() or the handlers change
+#define CACHEMAGIC "ICDECODE"
 
-    // Day 7
-    ref = &vm[STAGES];
-    load(ref, "input07.txt");  // load data into last VM, amps are numbered 0..STAGES-1
-    printf("Day 7 part 1: %"PRId64"\n", maxamp(1));  // right answer = 929800
-    printf("Day 7 part 2: %"PRId64"\n", maxamp(2));  // right answer = 15432220
+typedef struct cachehead {
+    char magic[8];     // CACHEMAGIC
+    uint32_t version;  // DECODEVER
+    uint32_t kinds;    // KINDS
+    uint64_t hash;     // of the program text, as interned
+    uint64_t size;     // program cells
+    uint64_t content;  // cellhash() of the program image
+    uint64_t count;    // instructions in the stream
+} CacheHead;
 
-    // Day 9 part 1
-    ref = &vm[0];
-    app = &vm[1];
-    load(ref, "input09.txt");
-    copyvm(app, ref);
-    fifo_push(1);
-    run(app);
-    printf("Day 9 part 1: %"PRId64"\n", fifo_pop());  // right answer = 4261108180
+static const char *cachedir = NULL;
 
-    // Day 9 part 2
-    copyvm(app, ref);
-    fifo_push(2);
-    run(app);
-    printf("Day 9 part 2: %"PRId64"\n", fifo_pop());  // right answer = 77944
+static void cachepath(char *path, const size_t len, const Image *img)
+{
+    snprintf(path, len, "%s/%016"PRIx64"-v%d.dec", cachedir, img->hash, DECODEVER);
+}
+
+// Map the decoded table of an image from the cache, false if there is no valid one
+static bool cacheload(Image *img)
+{
+    char path[4096];
+    cachepath(path, sizeof path, img);
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void *map = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(CacheHead)
+        ? mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    const CacheHead *h = map;
+    const size_t bytes = (size_t)st.st_size;
+    bool valid = !memcmp(h->magic, CACHEMAGIC, sizeof h->magic) && h->version == DECODEVER && h->kinds == KINDS
+        && h->hash == img->hash && h->size == img->size && h->count <= img->size
+        && bytes == sizeof *h + h->count * sizeof(Decoded) + img->size * sizeof(uint32_t)
+        && h->content == cellhash(img->mem, img->size);
+    // Every entry must be what decoding the program gives: a kind without a handler
+    // would jump anywhere, and one that doesn't match its cell would run the wrong
+    // semantics, reading parameters past the end of memory
+    const Decoded *dec = (const Decoded *)(h + 1);
+    const uint32_t *at = (const uint32_t *)(dec + (valid ? h->count : 0));
+    for (size_t i = 0; valid && i < h->count; ++i)
+        valid = dec[i].addr < img->size && at[dec[i].addr] == i + 1 && dec[i].in == img->mem[dec[i].addr]
+            && dec[i].kind == kind(img->mem, img->size, dec[i].addr) && dec[i].kind;
+    for (size_t a = 0; valid && a < img->size; ++a)
+        valid = at[a] <= h->count;
+    if (!valid) {
+        munmap(map, bytes);
+        return false;
+    }
+    img->dec = (Decoded *)dec;
+    img->declen = h->count;
+    img->at = (uint32_t *)at;
+    img->map = map;
+    img->mapped = bytes;
+    return true;
+}
 
+// Write the decoded table of an image to the cache, via a temporary file so
+// that other processes never map a partial one
+static void cachesave(const Image *img)
+{
+    char path[4096], tmp[4096 + 16];
+    cachepath(path, sizeof path, img);
+    snprintf(tmp, sizeof tmp, "%s.%d", path, (int)getpid());
+    mkdir(cachedir, 0777);  // may exist
+    FILE *f = fopen(tmp, "wb");
+    if (f == NULL)
+        return;
+    CacheHead h = { .version = DECODEVER, .kinds = KINDS, .hash = img->hash, .size = img->size,
+        .content = cellhash(img->mem, img->size), .count = img->declen };
+    memcpy(h.magic, CACHEMAGIC, sizeof h.magic);
+    const bool ok = fwrite(&h, sizeof h, 1, f) == 1
+        && fwrite(img->dec, sizeof *(img->dec), img->declen, f) == img->declen
+        && fwrite(img->at, sizeof *(img->at), img->size, f) == img->size;
+    if (fclose(f) == 0 && ok)
+        rename(tmp, path);
+    else
+        unlink(tmp);
+}
+
+// Give an image its decoded table: from the cache if possible, else decode it (and cache it)
+static void decode(Image *img)
+{
+    if (cachedir != NULL && cacheload(img))
+        return;
+    if (decodeall(img) && cachedir != NULL)
+        cachesave(img);
+}
+
+// Whether the threaded engine suits the image: the threaded engine checks every
+// instruction cell against the table and hands I/O and modified code to the
+// interpreter one instruction at a time, so it is for programs that don't
+// rewrite their own instructions and aren't dominated by I/O. The sweep is
+// done once per image, the first time it is hot, see hot()
+static bool threadable(Image *img)
+{
+    if (img->eng != ENG_AUTO)
+        return img->eng == ENG_THREADED;
+
+    // Linear sweep: instructions, I/O instructions, writes to instruction cells
+    bool *code = calloc(img->size, sizeof *code);
+    if (code == NULL)
+        return false;
+    size_t n = 0, io = 0;
+    for (size_t a = 0; a < img->size; ) {
+        const Lang *def = instr(img->mem, img->size, a);
+        if (def == NULL) {
+            ++a;
+            continue;
+        }
+        ++n;
+        io += def->op == INP || def->op == OUT;
+        code[a] = true;  // parameters may be data, the threaded engine reads them from memory
+        a += 1 + (size_t)def->pc;
+    }
+    size_t selfmod = 0;
+    for (size_t a = 0; a < img->size; ) {
+        const Lang *def = instr(img->mem, img->size, a);
+        if (def == NULL) {
+            ++a;
+            continue;
+        }
+        const int64_t q = img->mem[a + (size_t)def->pc];  // positional write to an instruction?
+        selfmod += def->oc && img->mem[a] / (def->pc == 3 ? 10000 : 100) % 10 == POS
+            && q >= 0 && (size_t)q < img->size && code[q];
+        a += 1 + (size_t)def->pc;
+    }
+    free(code);
+
+    img->eng = selfmod * SELFMOD > n || io * IODENSE > n ? ENG_INTERP : ENG_THREADED;
+    return img->eng == ENG_THREADED;
+}
+
+// Engine for a freshly loaded program. Decoding, and the sweep that decides
+// whether it's worth it, are paid for once per image, when it gets hot, so
+// short runs aren't charged for either; see runengine().
+static Engine pickengine(const VirtualMachine *pv, const Image *img)
+{
+    if (engine != ENG_AUTO)
+        return engine == ENG_THREADED && img == NULL ? ENG_INTERP : engine;
+#ifdef IMAGE
+    if (img == NULL && pv->size >= IMAGESIZE && !memcmp(pv->mem, image, sizeof image))
+        return ENG_IMAGE;  // embedded program
+#endif
+    if (img == NULL || pv->checked || img->eng == ENG_INTERP)
+        return ENG_INTERP;
+    return ENG_THREADED;  // once hot, if threadable()
+}
+
+// Load program from file into VM, sized for all the memory it will use
+static void load(VirtualMachine *pv, const char *filename)
+{
+    Image *img = readimage(pv, filename);
+    setsize(pv, reach(pv));
+    natives(pv);
+    pv->img = img;
+    pv->eng = pickengine(pv, img);
+    if (pv->eng == ENG_THREADED && img->dec == NULL) {
+        if (engine == ENG_THREADED)
+            decode(img);  // forced: decode now, not when hot
+        else if (cachedir != NULL && threadable(img))
+            cacheload(img);  // cached table is as good as hot
+    }
+    if (trace != NULL) {
+        char name[64];
+        snprintf(name, sizeof name, "load %s: %s", filename, engname[pv->eng]);
+        for (char *c = name; *c; ++c)
+            if (*c == '"' || *c == '\\' || (unsigned char)*c < ' ')
+                *c = '_';  // keep the JSON valid
+        traceevent(pv, "i", name, nanotime(), 0);
+    }
+}
+
+// Image has a decoded table: it has one, or interpreting it has already cost
+// more than decoding would and the threaded engine was forced or suits it
+static bool hot(Image *img)
+{
+    if (img->dec == NULL && img->ticks >= AMORTISE * img->size && (engine == ENG_THREADED || threadable(img)))
+        decode(img);
+    return img->dec != NULL;
+}
+
+static void interpret(VirtualMachine *pv);
+
+// Run the call in the interpreter on the state before, compare with the state after
+// the native version: ip, relative base and all memory below the callee's frame
+// (or all memory for intrinsics that don't have one)
+static void verify(const VirtualMachine *after, const VirtualMachine *before, const Intrinsic *f)
+{
+    VirtualMachine tmp = {0};
+    Fifo in = {0}, out = {0};
+    copyvm(&tmp, before);
+    tmp.natcount = 0;
+    tmp.in  = &in;
+    tmp.out = &out;
+    bool same = setbreak(&tmp, (size_t)after->ip);
+    while (same) {
+        const uint64_t t = tmp.ticks;
+        interpret(&tmp);
+        if (tmp.trap == (size_t)after->ip + 1 && tmp.base == before->base)
+            break;  // returned
+        if (tmp.halted || (tmp.ticks == t && !tmp.trap))
+            same = false;
+    }
+    clearbreak(&tmp, (size_t)after->ip);
+    same = same && tmp.ip == after->ip && tmp.base == after->base;
+    const int64_t lim = f->frame >= 0 ? before->base + f->frame : (int64_t)(tmp.size > after->size ? tmp.size : after->size);
+    for (int64_t i = 0; same && i < lim; ++i)
+        same = ((size_t)i < tmp.size ? tmp.mem[i] : 0) == ((size_t)i < after->size ? after->mem[i] : 0);
+    clean(&tmp);
+    if (!same) {
+        fprintf(stderr, "%s at %zu: ", f->name, (size_t)before->ip);
+        fatal(ERR_NATIVE);
+    }
+}
+
+// Called by the engines after every taken jump when the VM has recognised subroutines
+// VMs with breakpoints interpret them, so that breakpoints in them are hit
+static void callnative(VirtualMachine *pv)
+{
+    if (pv->brkcount)
+        return;
+    for (size_t i = 0; i < pv->natcount; ++i)
+        if ((ssize_t)pv->nat[i].addr == pv->ip) {
+            const Intrinsic *f = &intrinsic[pv->nat[i].which];
+            if (!recognised(f, pv->mem, pv->size, pv->nat[i].addr))
+                return;  // modified since load: interpret
+            if (nativemode == NAT_VERIFY) {
+                VirtualMachine before = {0};
+                copyvm(&before, pv);
+                if (f->fn(pv))
+                    verify(pv, &before, f);
+                clean(&before);
+            } else
+                f->fn(pv);
+            return;
+        }
+}
+
+// Sampling profiler: SIGPROF handler records the instruction address of the
+// running VM and the engine running it. Compiled images keep pv->ip current.
+// The interpreter advances pv->ip over the operands as it fetches them, so it
+// publishes the instruction start in interpip; the threaded engine keeps ip in
+// a register and publishes it in threadip. Both are a volatile store per
+// instruction so that the handler sees them.
+typedef struct sample {
+    ssize_t ip;
+    Engine eng;
+} Sample;
+
+static VirtualMachine *volatile running = NULL;
+static volatile sig_atomic_t tier = ENG_INTERP;  // Engine running it
+static volatile ssize_t interpip, threadip;
+static bool profiling = false;  // profile() was called
+static Sample sample[MAXSAMPLE];
+static volatile sig_atomic_t samples = 0;
+
+// Reference engine
+#define ENGINE execute
+#define ENGINE_ADD(x, y) WRAPADD(x, y)
+#define ENGINE_MUL(x, y) WRAPMUL(x, y)
+#include "engine.h"
+
+// Overflow-checked arithmetic
+#define ENGINE execute_checked
+#define ENGINE_ADD(x, y) checkedadd(x, y)
+#define ENGINE_MUL(x, y) checkedmul(x, y)
+#include "engine.h"
+
+// Plain stdin/stdout I/O, for whole programs
+#define ENGINE execute_stdio
+#define ENGINE_ADD(x, y) WRAPADD(x, y)
+#define ENGINE_MUL(x, y) WRAPMUL(x, y)
+#define ENGINE_STDIO
+#include "engine.h"
+
+// Breakpoints, for the debugger and verify()
+#define ENGINE execute_break
+#define ENGINE_ADD(x, y) (pv->checked ? checkedadd(x, y) : WRAPADD(x, y))
+#define ENGINE_MUL(x, y) (pv->checked ? checkedmul(x, y) : WRAPMUL(x, y))
+#define ENGINE_BREAK
+#include "engine.h"
+
+static void interpret(VirtualMachine *pv)
+{
+    if (pv->brkcount)
+        execute_break(pv);
+    else if (pv->checked)
+        execute_checked(pv);
+    else
+        execute(pv);
+}
+
+// Execute one instruction in the interpreter, false if the caller should return
+static bool step(VirtualMachine *pv)
+{
+    const uint64_t limit = pv->limit, t = pv->ticks;
+    const bool out = pv->ip >= 0 && (size_t)pv->ip < pv->size && pv->mem[pv->ip] % 100 == OUT && pv->out == NULL;
+    const sig_atomic_t eng = tier;
+    pv->limit = t + 1;
+    tier = ENG_INTERP;
+    interpret(pv);
+    tier = eng;
+    pv->limit = limit;
+    return pv->ticks != t && !pv->halted && !out && (!limit || pv->ticks < limit);
+}
+
+// Threaded engine: dispatch on the pre-decoded table by computed goto, one
+// handler per opcode and parameter modes so that decoding is folded away.
+// Whatever isn't in the table (I/O, modified code) is executed by the
+// interpreter, one instruction at a time. VMs with breakpoints don't run here.
+#define RD(m, k) ((m) == IMM ? pv->mem[ip + (k)] : *cell(pv, pv->mem[ip + (k)] + ((m) == REL ? pv->base : 0), ERR_PAR_READ))
+#define WR(m, k) cell(pv, pv->mem[ip + (k)] + ((m) == REL ? pv->base : 0), ERR_PAR_WRITE)
+#define MODES2(X, op) X(op, 0, 0, 0) X(op, 1, 0, 0) X(op, 2, 0, 0) X(op, 0, 1, 0) X(op, 1, 1, 0) \
+    X(op, 2, 1, 0) X(op, 0, 2, 0) X(op, 1, 2, 0) X(op, 2, 2, 0)
+#define MODES3(X, op) MODES2(X, op) X(op, 0, 0, 2) X(op, 1, 0, 2) X(op, 2, 0, 2) X(op, 0, 1, 2) \
+    X(op, 1, 1, 2) X(op, 2, 1, 2) X(op, 0, 2, 2) X(op, 1, 2, 2) X(op, 2, 2, 2)
+#define LABEL(op, m0, m1, m2) [KIND(op, m0, m1, m2)] = &&op##_##m0##m1##m2,
+#define ARITH(op, m0, m1, m2, expr) op##_##m0##m1##m2: { \
+        const int64_t x = RD(m0, 1), y = RD(m1, 2); \
+        *WR(m2, 3) = (expr); \
+        ip += 4; \
+        goto dispatch; }
+#define BRANCH(op, m0, m1, cond) op##_##m0##m1##0: { \
+        const int64_t x = RD(m0, 1); \
+        if (!(cond)) { \
+            ip += 3; \
+            goto dispatch; } \
+        pv->ip = RD(m1, 2); \
+        if (interrupted(pv)) \
+            return; \
+        if (pv->natcount) \
+            callnative(pv); \
+        ip = (size_t)pv->ip; \
+        goto dispatch; }
+#define DO_ADD(op, m0, m1, m2) ARITH(op, m0, m1, m2, WRAPADD(x, y))
+#define DO_MUL(op, m0, m1, m2) ARITH(op, m0, m1, m2, WRAPMUL(x, y))
+#define DO_LT(op, m0, m1, m2)  ARITH(op, m0, m1, m2, x < y)
+#define DO_EQ(op, m0, m1, m2)  ARITH(op, m0, m1, m2, x == y)
+#define DO_JNZ(op, m0, m1, m2) BRANCH(op, m0, m1, x)
+#define DO_JPZ(op, m0, m1, m2) BRANCH(op, m0, m1, !x)
+
+static void threaded(VirtualMachine *pv)
+{
+    static const void *const label[KINDS] = {
+        MODES3(LABEL, ADD) MODES3(LABEL, MUL) MODES3(LABEL, LT) MODES3(LABEL, EQ)
+        MODES2(LABEL, JNZ) MODES2(LABEL, JPZ)
+        LABEL(RBO, 0, 0, 0) LABEL(RBO, 1, 0, 0) LABEL(RBO, 2, 0, 0)
+        LABEL(HLT, 0, 0, 0)
+    };
+    const Decoded *dec = pv->img->dec;
+    const uint32_t *at = pv->img->at;
+    const size_t n = pv->img->declen, size = pv->img->size;
+    size_t ip = (size_t)pv->ip;  // negative ip is never in the table, the interpreter fails on it
+    size_t i = SIZE_MAX;         // position in the instruction stream
+
+    if (pv->halted || interrupted(pv))
+        return;
+dispatch:
+    threadip = (ssize_t)ip;
+    if (pv->limit && pv->ticks >= pv->limit) {
+        pv->ip = (ssize_t)ip;
+        return;
+    }
+    if (++i >= n || dec[i].addr != ip)  // not the next one in the stream: jumped
+        i = ip < size && at[ip] ? at[ip] - 1 : SIZE_MAX;
+    if (i != SIZE_MAX && pv->mem[ip] == dec[i].in) {
+        ++pv->ticks;
+        goto *label[dec[i].kind];
+    }
+    pv->ip = (ssize_t)ip;
+    if (!step(pv))
+        return;
+    ip = (size_t)pv->ip;
+    goto dispatch;
+
+    MODES3(DO_ADD, ADD) MODES3(DO_MUL, MUL) MODES3(DO_LT, LT) MODES3(DO_EQ, EQ)
+    MODES2(DO_JNZ, JNZ) MODES2(DO_JPZ, JPZ)
+RBO_000:
+    pv->base += RD(POS, 1);
+    ip += 2;
+    goto dispatch;
+RBO_100:
+    pv->base += RD(IMM, 1);
+    ip += 2;
+    goto dispatch;
+RBO_200:
+    pv->base += RD(REL, 1);
+    ip += 2;
+    goto dispatch;
+HLT_000:
+    pv->ip = (ssize_t)ip + 1;
+    pv->halted = true;
+}
+
+#undef RD
+#undef WR
+#undef MODES2
+#undef MODES3
+#undef LABEL
+#undef ARITH
+#undef BRANCH
+#undef DO_ADD
+#undef DO_MUL
+#undef DO_LT
+#undef DO_EQ
+#undef DO_JNZ
+#undef DO_JPZ
+
+// Run VM on its engine, return the engine that ran it
+static Engine runengine(VirtualMachine *pv)
+{
+#ifdef IMAGE
+    if (pv->eng == ENG_IMAGE && !pv->checked && !pv->brkcount) {
+        // Compiled image with interpreter fallback; after a few instructions in a row
+        // that aren't compiled, assume heavily modified code and leave it to the interpreter
+        tier = ENG_IMAGE;
+        ImageExit e;
+        int misses = 0;
+        uint64_t t = pv->ticks;
+        while ((e = imagerun(pv)) == IMG_STEP && misses < 16) {
+            misses = pv->ticks == t ? misses + 1 : 0;
+            if (!step(pv))
+                break;
+            t = pv->ticks;
+        }
+        if (e == IMG_NONE || misses == 16) {
+            tier = ENG_INTERP;
+            interpret(pv);
+        }
+        return ENG_IMAGE;
+    }
+#endif
+    if (pv->eng == ENG_THREADED && !pv->checked && !pv->brkcount && pv->img != NULL && hot(pv->img)) {
+        threadip = pv->ip;
+        tier = ENG_THREADED;
+        threaded(pv);
+        return ENG_THREADED;
+    }
+    const uint64_t t = pv->ticks;
+    const bool switchable = pv->eng == ENG_THREADED && !pv->checked && !pv->brkcount && pv->img != NULL
+                            && pv->img->ticks < AMORTISE * pv->img->size;
+    if (switchable)  // not hot yet: come back at the block boundary where it gets hot
+        pv->hotat = t + AMORTISE * pv->img->size - pv->img->ticks;
+    tier = ENG_INTERP;
+    interpret(pv);
+    if (pv->img != NULL)
+        pv->img->ticks += pv->ticks - t;
+    if (switchable && pv->hotat == 0) {  // got hot during this run
+        if (hot(pv->img)) {
+            threadip = pv->ip;
+            tier = ENG_THREADED;
+            threaded(pv);
+            return ENG_THREADED;
+        }
+        const uint64_t u = pv->ticks;  // not threadable or couldn't decode it, carry on interpreting
+        interpret(pv);
+        pv->img->ticks += pv->ticks - u;
+    }
+    pv->hotat = 0;
+    return ENG_INTERP;
+}
+
+// Why run() returned, for the trace
+static const char *stopreason(const VirtualMachine *pv)
+{
+    if (pv->halted)
+        return "halted";
+    if (stopped(pv))
+        return "paused";
+    if (pv->trap)
+        return "breakpoint";
+    if (pv->limit && pv->ticks >= pv->limit)
+        return "limit";
+    const int64_t op = pv->ip >= 0 && (size_t)pv->ip < pv->size ? pv->mem[pv->ip] % 100 : NOP;
+    if (op == INP && pv->in != NULL && pv->in->head == pv->in->tail)
+        return "blocked on input";
+    if (op == OUT && pv->out != NULL && isfull(pv->out))
+        return "blocked on output";
+    return "yielded";  // output to the shared fifo
+}
+
+static uint64_t engticks[sizeof engname / sizeof *engname];  // instructions run() executed per engine
+
+static void run(VirtualMachine *pv)
+{
+    running = pv;
+    const uint64_t t = pv->ticks;
+    if (trace == NULL)
+        engticks[runengine(pv)] += pv->ticks - t;
+    else {
+        const Decoded *dec = pv->img != NULL ? pv->img->dec : NULL;
+        const uint64_t t0 = nanotime();
+        const Engine e = runengine(pv);
+        engticks[e] += pv->ticks - t;
+        const uint64_t t1 = nanotime();
+        if (e == ENG_THREADED && dec == NULL)
+            traceevent(pv, "i", "engine: threaded", t0, 0);  // decoded when it got hot
+        traceevent(pv, "X", engname[e], t0, t1);
+        traceevent(pv, "i", stopreason(pv), t1, 0);
+    }
+    running = NULL;
+}
+
+// Host API: drive a VM with private channels like a coroutine. Reading an
+// output or writing an input resumes the VM inline, in the caller's thread,
+// for as long as it takes; the VM keeps its place between calls.
+typedef enum vmstate {
+    VM_OUT,      // got an output
+    VM_BLOCKED,  // VM needs input first (or is paused, or stopped at a breakpoint)
+    VM_HALT,     // VM halted, no more outputs
+} VmState;
+
+// Next output of the VM in *val, running it only if there is none yet
+static VmState vmread(VirtualMachine *pv, int64_t *val)
+{
+    while (!dequeue(pv->out, val)) {
+        if (pv->halted)
+            return VM_HALT;
+        const uint64_t t = pv->ticks;
+        run(pv);
+        if (pv->ticks == t && pv->out->head == pv->out->tail)
+            return pv->halted ? VM_HALT : VM_BLOCKED;
+    }
+    return VM_OUT;
+}
+
+// Give the VM an input, running it to make room if its input channel is full;
+// false if it can't take any (halted, or blocked on output nobody reads)
+static bool vmwrite(VirtualMachine *pv, const int64_t val)
+{
+    while (!enqueue(pv->in, val)) {
+        const uint64_t t = pv->ticks;
+        if (pv->halted)
+            return false;
+        run(pv);
+        if (pv->ticks == t)
+            return false;
+    }
+    return true;
+}
+
+static void onprof(int sig)
+{
+    (void)sig;
+    VirtualMachine *pv = running;
+    if (pv != NULL && samples < MAXSAMPLE)
+        sample[samples++] = (Sample){
+            .ip = tier == ENG_THREADED ? threadip : tier == ENG_INTERP ? interpip : pv->ip,
+            .eng = (Engine)tier
+        };
+}
+
+// Start sampling every usec microseconds of CPU time (max 999999)
+static void profile(const long usec)
+{
+    struct sigaction sa = { .sa_handler = onprof, .sa_flags = SA_RESTART };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+    const struct itimerval it = { .it_interval = { .tv_usec = usec }, .it_value = { .tv_usec = usec } };
+    setitimer(ITIMER_PROF, &it, NULL);
+    profiling = true;
+}
+
+// SIGINT asks the running VM to stop at its next block boundary, with pausevm()
+// or killvm() as the host chose in interruptible(), and the host deals with it
+// when run() returns. Without a running VM, or when it hasn't stopped since the
+// last one, SIGINT has its default effect.
+static void (*onstop)(VirtualMachine *pv) = NULL;
+
+static void onint(int sig)
+{
+    VirtualMachine *pv = running;
+    if (pv != NULL && !stopped(pv))
+        onstop(pv);
+    else {
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
+}
+
+static void interruptible(void (*stop)(VirtualMachine *pv))
+{
+    onstop = stop;
+    struct sigaction sa = { .sa_handler = onint, .sa_flags = SA_RESTART };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+}
+
+static int cmpsample(const void *a, const void *b)
+{
+    const Sample *x = a, *y = b;
+    if (x->ip != y->ip)
+        return (x->ip > y->ip) - (x->ip < y->ip);
+    return (x->eng > y->eng) - (x->eng < y->eng);
+}
+
+// Address and engine with their number of samples
+typedef struct hotspot {
+    Sample at;
+    size_t count;
+} Hotspot;
+
+// Most samples first, then lowest address
+static int cmphotspot(const void *a, const void *b)
+{
+    const Hotspot *x = a, *y = b;
+    if (x->count != y->count)
+        return (x->count < y->count) - (x->count > y->count);
+    return cmpsample(&x->at, &y->at);
+}
+
+// Stop sampling and print the hottest addresses, per engine, if profiling
+static void hotspots(FILE *f, const int top)
+{
+    if (!profiling)
+        return;
+    profiling = false;
+    const struct itimerval off = {0};
+    setitimer(ITIMER_PROF, &off, NULL);
+    const size_t n = (size_t)samples;
+    fprintf(f, "Profile: %zu samples\n", n);
+    if (!n)
+        return;
+    Hotspot *spot = malloc(n * sizeof *spot);
+    if (spot == NULL)
+        return;
+    qsort(sample, n, sizeof *sample, cmpsample);
+    size_t m = 0;
+    for (size_t i = 0, j; i < n; i = j) {
+        for (j = i + 1; j < n && !cmpsample(&sample[j], &sample[i]); ++j)
+            ;
+        spot[m++] = (Hotspot){ .at = sample[i], .count = j - i };
+    }
+    qsort(spot, m, sizeof *spot, cmphotspot);
+    for (size_t k = 0; k < (size_t)top && k < m; ++k)
+        fprintf(f, "%8zd %8zu %5.1f%% %s\n", spot[k].at.ip, spot[k].count, 100.0 * spot[k].count / n, engname[spot[k].at.eng]);
+    free(spot);
+    samples = 0;
+}
+
+// Checkpoints of one VM, taken every so many instructions, for reverse execution
+// Inputs are replayed from the input channel, so it must not wrap around in between
+typedef struct history {
+    VirtualMachine snap[MAXSNAP];
+    size_t intail[MAXSNAP], outhead[MAXSNAP];  // I/O channel positions at each checkpoint
+    size_t count;
+    uint64_t every;  // instructions between checkpoints
+} History;
+
+static Fifo *inchan(const VirtualMachine *pv)
+{
+    return pv->in != NULL ? pv->in : &fifo;
+}
+
+static Fifo *outchan(const VirtualMachine *pv)
+{
+    return pv->out != NULL ? pv->out : &fifo;
+}
+
+static void checkpoint(History *h, const VirtualMachine *pv)
+{
+    if (h->count == MAXSNAP) {
+        // Full: keep every other checkpoint and take them half as often
+        for (size_t i = 1; i < MAXSNAP / 2; ++i) {
+            copyvm(&h->snap[i], &h->snap[i * 2]);
+            h->intail[i]  = h->intail[i * 2];
+            h->outhead[i] = h->outhead[i * 2];
+        }
+        h->count = MAXSNAP / 2;
+        h->every *= 2;
+    }
+    copyvm(&h->snap[h->count], pv);
+    h->intail[h->count]  = inchan(pv)->tail;
+    h->outhead[h->count] = outchan(pv)->head;
+    h->count++;
+}
+
+static void forget(History *h)
+{
+    for (size_t i = 0; i < MAXSNAP; ++i)
+        clean(&h->snap[i]);
+    *h = (History){0};
+}
+
+// Run VM like run(), taking a checkpoint every so many instructions
+static void record(VirtualMachine *pv, History *h)
+{
+    if (!h->every)
+        h->every = 1000000;
+    if (!h->count)
+        checkpoint(h, pv);
+    while (!pv->halted) {
+        pv->limit = h->snap[h->count - 1].ticks + h->every;
+        run(pv);
+        pv->limit = 0;
+        if (pv->ticks != h->snap[h->count - 1].ticks + h->every)
+            return;  // returned for other reasons than the limit: I/O, breakpoint, host request
+        checkpoint(h, pv);
+    }
+}
+
+// Run VM forward to exactly target instructions, if it gets that far
+static void replay(VirtualMachine *pv, const uint64_t target)
+{
+    pv->limit = target;
+    while (!pv->halted && pv->ticks < target) {
+        const uint64_t t = pv->ticks;
+        run(pv);
+        if (pv->ticks == t && !pv->trap)
+            break;  // blocked
+    }
+    pv->limit = 0;
+}
+
+// Restore nearest checkpoint before target in VM and its I/O channels
+// Returns false if there is none
+static bool restore(VirtualMachine *pv, const History *h, const uint64_t target)
+{
+    size_t i = h->count;
+    while (i && h->snap[i - 1].ticks > target)
+        --i;
+    if (!i--)
+        return false;
+    copyvm(pv, &h->snap[i]);
+    inchan(pv)->tail = h->intail[i];
+    Fifo *out = outchan(pv);
+    const size_t produced = (out->head + FIFOSIZE - h->outhead[i]) % FIFOSIZE;
+    if ((out->tail + FIFOSIZE - h->outhead[i]) % FIFOSIZE <= produced)
+        out->tail = h->outhead[i];  // outputs since the checkpoint were taken, produce them again
+    out->head = h->outhead[i];
+    return true;
+}
+
+// Go back (or forward) to the state after target instructions
+static bool travel(VirtualMachine *pv, const History *h, const uint64_t target)
+{
+    if (!restore(pv, h, target))
+        return false;
+    replay(pv, target);
+    return pv->ticks == target;
+}
+
+// Undo the last instruction
+static bool stepback(VirtualMachine *pv, const History *h)
+{
+    return pv->ticks && travel(pv, h, pv->ticks - 1);
+}
+
+// Go back to just before the last instruction that changed the value at addr
+// Returns false if it didn't change since the first checkpoint
+static bool lastchange(VirtualMachine *pv, const History *h, const size_t addr)
+{
+    const uint64_t now = pv->ticks;
+    for (size_t i = h->count; i--; ) {
+        if (h->snap[i].ticks >= now)
+            continue;
+        // Replay this stretch one instruction at a time on a scratch VM with copies of the channels
+        VirtualMachine tmp = {0};
+        Fifo in = *inchan(pv), out = *outchan(pv);
+        copyvm(&tmp, &h->snap[i]);
+        in.tail  = h->intail[i];
+        out.head = h->outhead[i];
+        tmp.in  = &in;
+        tmp.out = &out;
+        uint64_t found = 0;
+        const uint64_t end = i + 1 < h->count && h->snap[i + 1].ticks < now ? h->snap[i + 1].ticks : now;
+        while (tmp.ticks < end) {
+            const int64_t val = addr < tmp.size ? tmp.mem[addr] : 0;
+            const uint64_t t = tmp.ticks;
+            replay(&tmp, t + 1);
+            if (tmp.ticks == t)
+                break;
+            if ((addr < tmp.size ? tmp.mem[addr] : 0) != val)
+                found = tmp.ticks;
+            out.tail = out.head;  // discard outputs
+        }
+        clean(&tmp);
+        if (found)
+            return travel(pv, h, found - 1);
+    }
+    return false;
+}
+
+// Permutate in lexicographic order, adapted from "perm1()"
+// at http://www.rosettacode.org/wiki/Permutations#version_4
+static int next_perm(int *a, int n)
+{
+	int k, l, t;
+
+	for (k = n - 1; k && a[k - 1] >= a[k]; --k)
+        ;
+	if (!k--)
+        return 0;
+	for (l = n - 1; a[l] <= a[k]; l--)
+        ;
+    t = a[k]; a[k] = a[l]; a[l] = t;
+	for (k++, l = n - 1; l > k; l--, k++)
+        t = a[k]; a[k] = a[l]; a[l] = t;
+	return 1;
+}
+
+// Run a copy of src ahead with a predicted input, until it halts or blocks on
+// the next input. Outputs produced on the way are kept in out.
+static void speculate(VirtualMachine *branch, const VirtualMachine *src, const int64_t guess, Fifo *out)
+{
+    Fifo in = {0};
+    copyvm(branch, src);
+    reset(out);
+    enqueue(&in, guess);
+    branch->in  = &in;
+    branch->out = out;
+    run(branch);
+    branch->in = branch->out = NULL;  // never run again, only committed
+}
+
+// Continue in dst from a speculative branch whose predicted input has arrived
+static void commit(VirtualMachine *dst, const VirtualMachine *branch, const Fifo *out)
+{
+    Fifo tmp = *out;
+    int64_t val;
+    copyvm(dst, branch);
+    reset(dst->out);
+    while (dequeue(&tmp, &val))
+        enqueue(dst->out, val);
+}
+
+// Run a ring of VMs in logical rounds. In every round, each VM runs until it halts or
+// blocks on I/O, touching only its own memory and channels. Outputs are delivered
+// to the next VM in the ring at the round boundary, in VM order. So the result
+// doesn't depend on how VMs are scheduled within a round.
+// Stops when all VMs have halted or when a round makes no progress (deadlock).
+static void rounds(VirtualMachine *ring, size_t count)
+{
+    bool progress = true;
+    while (progress) {
+        for (size_t i = 0; i < count; ++i)
+            run(&ring[i]);
+        progress = false;
+        for (size_t i = 0; i < count; ++i) {
+            Fifo *next = ring[(i + 1) % count].in;
+            int64_t val;
+            while (!isfull(next) && dequeue(ring[i].out, &val)) {
+                enqueue(next, val);
+                progress = true;
+            }
+        }
+    }
+}
+
+// Maximum amplification for different phase permutations
+// amp = VirtualMachines array of length STAGES
+static int64_t maxamp(int part)
+{
+    int64_t amax = -1;
+    int phase[STAGES];
+
+    // Initial phase numbers: 0-4 for part 1, 5-9 for part 2
+	for (int i = 0; i < STAGES; ++i)
+        phase[i] = STAGES * (part - 1) + i;
+
+    // The first input of every amp is one of these phases, so run ahead once
+    // for each of them instead of for every amp in every permutation
+    for (int i = 0; i < STAGES; ++i)
+        speculate(&spec[i], &vm[STAGES], phase[i], &specout[i]);
+
+    // All permutations of phase array
+	do {
+        // Start every permutation with fresh amps that got their phase, wired in a ring
+        // Part 1 has no feedback because the first amp has halted when the last one outputs
+        for (int i = 0; i < STAGES; ++i) {
+            reset(&inbox[i]);
+            vm[i].in  = &inbox[i];
+            vm[i].out = &outbox[i];
+            const int k = phase[i] - STAGES * (part - 1);
+            commit(&vm[i], &spec[k], &specout[k]);
+        }
+        enqueue(&inbox[0], 0);
+        rounds(vm, STAGES);
+        // Final output of the last amp ends up in the input of the first one
+        int64_t a = 0, val;
+        while (dequeue(&inbox[0], &val))
+            a = val;
+        if (a > amax)
+            amax = a;
+	} while (next_perm(phase, STAGES));
+
+    for (int i = 0; i < STAGES; ++i)
+        vm[i].in = vm[i].out = NULL;
+    return amax;
+}
+
+// One shard of the day 2 part 2 parameter sweep: all nouns for one verb
+// Returns noun * 100 + verb for the first noun that gives the magic number, or -1
+static int day2shard(VirtualMachine *app, const VirtualMachine *ref, int verb)
+{
+    static const int magic = 19690720;
+    for (int noun = 0; noun < SWEEP; ++noun) {
+        copyvm(app, ref);
+        app->mem[1] = noun;
+        app->mem[2] = verb;
+        run(app);
+        if (app->mem[0] == magic)
+            return noun * 100 + verb;
+    }
+    return -1;
+}
+
+// Shard result as reported by a worker process
+typedef struct shard {
+    int verb, result;
+} Shard;
+
+#define PENDING (-2)  // shard result not (yet) received
+
+// Sweep is settled when every shard before the first match has reported
+static bool settled(const int *result)
+{
+    for (int i = 0; i < SWEEP; ++i)
+        if (result[i] != -1)
+            return result[i] != PENDING;
+    return true;
+}
+
+// Sweep the parameter space with worker processes that take shards from a task pipe
+// and report on a result pipe. Fast workers take more shards, so stragglers don't hold
+// up the sweep. Shards lost to a crashed worker (or to a failed fork) are redone here.
+static int day2part2(VirtualMachine *app, VirtualMachine *ref)
+{
+    int result[SWEEP];
+    for (int i = 0; i < SWEEP; ++i)
+        result[i] = PENDING;
+
+    int task[2], done[2];
+    if (pipe(task) == 0) {
+        if (pipe(done) == 0) {
+            // All tasks fit in the pipe buffer, and small writes/reads are atomic
+            for (int i = 0; i < SWEEP; ++i)
+                if (write(task[1], &i, sizeof i) != sizeof i)
+                    break;
+            close(task[1]);
+
+            pid_t pid[WORKERS];
+            int workers = 0;
+            fflush(stdout);  // don't duplicate buffered output in the workers
+            while (workers < WORKERS && (pid[workers] = fork()) >= 0) {
+                if (pid[workers] == 0) {
+                    Shard s;
+                    trace = NULL;  // not traced, the parent owns the file
+                    close(done[0]);
+                    while (read(task[0], &s.verb, sizeof s.verb) == sizeof s.verb) {
+                        s.result = day2shard(app, ref, s.verb);
+                        if (write(done[1], &s, sizeof s) != sizeof s)
+                            break;
+                    }
+                    _exit(0);
+                }
+                ++workers;
+            }
+            close(task[0]);
+            close(done[1]);
+
+            // Aggregate until the first match is known, or all workers are gone
+            Shard s;
+            while (!settled(result) && read(done[0], &s, sizeof s) == sizeof s)
+                if (s.verb >= 0 && s.verb < SWEEP)
+                    result[s.verb] = s.result;
+            close(done[0]);
+            for (int i = 0; i < workers; ++i) {
+                kill(pid[i], SIGTERM);
+                waitpid(pid[i], NULL, 0);
+            }
+        } else {
+            close(task[0]);
+            close(task[1]);
+        }
+    }
+
+    for (int verb = 0; verb < SWEEP; ++verb) {
+        if (result[verb] == PENDING)
+            result[verb] = day2shard(app, ref, verb);
+        if (result[verb] >= 0)
+            return result[verb];
+    }
+    return -1;
+}
+
+// End-to-end benchmark workloads, on programs loaded in vm[ref]
+static int64_t wl_day2(void)
+{
+    copyvm(&vm[1], &vm[0]);
+    vm[1].mem[1] = 12;
+    vm[1].mem[2] = 2;
+    run(&vm[1]);
+    return vm[1].mem[0];
+}
+
+static int64_t wl_day2sweep(void)
+{
+    // In-process, to time the engine and not the worker processes
+    for (int verb = 0; verb < SWEEP; ++verb) {
+        int res = day2shard(&vm[1], &vm[0], verb);
+        if (res >= 0)
+            return res;
+    }
+    return -1;
+}
+
+static int64_t wl_day7part1(void)
+{
+    return maxamp(1);
+}
+
+static int64_t wl_day7part2(void)
+{
+    return maxamp(2);
+}
+
+static int64_t wl_day9part1(void)
+{
+    copyvm(&vm[1], &vm[0]);
+    fifo_push(1);
+    run(&vm[1]);
+    return fifo_pop();
+}
+
+static int64_t wl_day9part2(void)
+{
+    copyvm(&vm[1], &vm[0]);
+    fifo_push(2);
+    run(&vm[1]);
+    return fifo_pop();
+}
+
+typedef struct workload {
+    const char *name, *file;
+    size_t ref;  // VM to load the program into
+    int64_t (*fn)(void);
+} Workload;
+
+static const Workload workload[] = {
+    { "day2",       "input02.txt", 0,      wl_day2       },
+    { "day2sweep",  "input02.txt", 0,      wl_day2sweep  },
+    { "day7part1",  "input07.txt", STAGES, wl_day7part1  },
+    { "day7part2",  "input07.txt", STAGES, wl_day7part2  },
+    { "day9part1",  "input09.txt", 0,      wl_day9part1  },
+    { "day9part2",  "input09.txt", 0,      wl_day9part2  },
+};
+static const size_t workloads = sizeof workload / sizeof *workload;
+
+typedef struct result {
+    char workload[32], engine[16];
+    int runs;
+    double mean, sd;  // ns per iteration
+} Result;
+
+static volatile int64_t sink;  // keeps benchmark results alive
+
+// Time fn: BENCHRUNS samples of enough iterations to take at least BENCHMIN ns each
+static Result measure(int64_t (*fn)(void))
+{
+    int iter = 1;
+    uint64_t t0 = nanotime();
+    sink = fn();
+    uint64_t dt = nanotime() - t0;
+    if (dt < BENCHMIN)
+        iter = (int)(BENCHMIN / (dt + 1)) + 1;
+
+    double sum = 0, sum2 = 0;
+    for (int i = 0; i < BENCHRUNS; ++i) {
+        t0 = nanotime();
+        for (int j = 0; j < iter; ++j)
+            sink = fn();
+        const double x = (double)(nanotime() - t0) / iter;
+        sum += x;
+        sum2 += x * x;
+    }
+    Result r = { .runs = BENCHRUNS, .mean = sum / BENCHRUNS };
+    const double var = (sum2 - sum * r.mean) / (BENCHRUNS - 1);
+    r.sd = var > 0 ? sqrt(var) : 0;
+    return r;
+}
+
+// Most recent result for workload & engine in a results file, false if none
+static bool lookup(const char *filename, const Result *cur, Result *res)
+{
+    FILE *f = fopen(filename, "r");
+    if (f == NULL)
+        return false;
+    bool found = false;
+    char *line = NULL;
+    size_t len = 0;
+    while (getline(&line, &len, f) > 0) {
+        Result r;
+        if (sscanf(line, "%*s %*s %*s %*s %31s %15s %d %lf %lf", r.workload, r.engine, &r.runs, &r.mean, &r.sd) == 5
+            && !strcmp(r.workload, cur->workload) && !strcmp(r.engine, cur->engine)) {
+            *res = r;
+            found = true;
+        }
+    }
+    free(line);
+    fclose(f);
+    return found;
+}
+
+// Significant slowdown: more than BENCHMARGIN slower and Welch's t above 3. The
+// samples of one run share the state of its process (code layout, clock speed),
+// so t overstates the significance between runs; bench() also wants the
+// previous run to agree.
+static bool slower(const Result *cur, const Result *base)
+{
+    const double se = sqrt(cur->sd * cur->sd / cur->runs + base->sd * base->sd / base->runs);
+    return cur->mean > base->mean * BENCHMARGIN && (se == 0 || (cur->mean - base->mean) / se > 3);
+}
+
+// Component micro-benchmarks, on the program loaded in vm[0]
+#define MICROFILE "input09.txt"
+#define FIFOOPS   (1000)  // push/pop pairs per fifo iteration
+
+static int64_t mb_load(void)
+{
+    forgetimages();  // time the parser, not the interned copy
+    load(&vm[0], MICROFILE);
+    return (int64_t)vm[0].size;
+}
+
+// Decode every cell as an instruction, same steps as execute()
+static int64_t mb_decode(void)
+{
+    int64_t sum = 0;
+    for (size_t i = 0; i < vm[0].size; ++i) {
+        int64_t in = vm[0].mem[i];
+        const Lang *def = getdef(in % 100);
+        in /= 100;
+        for (int pc = 0; pc < def->pc; ++pc) {
+            sum += in % 10;
+            in /= 10;
+        }
+        sum += def->op;
+    }
+    return sum;
+}
+
+static int64_t mb_copyvm(void)
+{
+    copyvm(&vm[1], &vm[0]);
+    return (int64_t)vm[1].size;
+}
+
+static int64_t mb_fifo(void)
+{
+    static Fifo f = {0};
+    int64_t sum = 0, val;
+    for (int i = 0; i < FIFOOPS; ++i) {
+        enqueue(&f, i);
+        dequeue(&f, &val);
+        sum += val;
+    }
+    return sum;
+}
+
+// Run one or all micro-benchmarks: load, decode, copyvm, fifo
+static int micro(int argc, char *argv[])
+{
+    const char *only = argc > 0 ? argv[0] : NULL;
+    Result r;
+
+    if (only == NULL || !strcmp(only, "load")) {
+        FILE *f = fopen(MICROFILE, "r");
+        if (f == NULL)
+            fatal(ERR_FILE_NOTFOUND);
+        fseek(f, 0, SEEK_END);
+        const long bytes = ftell(f);
+        fclose(f);
+        r = measure(mb_load);
+        printf("load    %8zu cells %10.0f ns %8.1f MB/s\n", vm[0].size, r.mean, bytes / r.mean * 1e3);
+    }
+    if (only == NULL || !strcmp(only, "decode")) {
+        load(&vm[0], MICROFILE);
+        r = measure(mb_decode);
+        printf("decode  %8zu cells %10.2f ns/cell\n", vm[0].size, r.mean / vm[0].size);
+    }
+    if (only == NULL || !strcmp(only, "copyvm")) {
+        for (size_t n = 1 << 10; n <= 1 << 20; n <<= 3) {
+            clean(&vm[0]);
+            clean(&vm[1]);
+            setsize(&vm[0], n);
+            r = measure(mb_copyvm);
+            printf("copyvm  %8zu cells %10.0f ns %8.2f GB/s\n", n, r.mean, n * sizeof *vm[0].mem / r.mean);
+        }
+    }
+    if (only == NULL || !strcmp(only, "fifo")) {
+        r = measure(mb_fifo);
+        printf("fifo    %8d pairs %10.2f ns/push+pop\n", FIFOOPS, r.mean / FIFOOPS);
+    }
+    clean_all();
+    return 0;
+}
+
+// Cold single run of a workload: fresh image, load and run once, so engine
+// choice and decoding are paid for in the time as they are by a real run
+static const Workload *cold;
+
+// Engine that executed the most instructions since engticks was cleared
+static Engine mostran(void)
+{
+    Engine ran = ENG_INTERP;
+    for (Engine e = ENG_INTERP; e <= ENG_IMAGE; ++e)
+        if (engticks[e] > engticks[ran])
+            ran = e;
+    return ran;
+}
+
+static int64_t wl_cold(void)
+{
+    forgetimages();
+    load(&vm[cold->ref], cold->file);
+    return cold->fn();
+}
+
+// Time a cold run of every workload on every engine and on auto, compare auto
+// with the fastest. "ran" is the engine auto executed most instructions in.
+// Natives are off, else day 9 would time the intrinsic rather than the engines,
+// and so is the decode cache, else it would be warm after the first run
+// Returns 1 if auto is significantly slower than the fastest for any workload, else 0
+static int engines(void)
+{
+    int miss = 0;
+    const char *dir = cachedir;
+    nativemode = NAT_OFF;
+    cachedir = NULL;
+    printf("%-12s", "workload");
+    for (Engine e = ENG_INTERP; e <= ENG_IMAGE; ++e)
+        printf(" %12s", engname[e]);
+    printf(" %12s  %-9s %-9s\n", engname[ENG_AUTO], "fastest", "ran");
+    for (size_t i = 0; i < workloads; ++i) {
+        Result r[sizeof engname / sizeof *engname] = {0};
+        Engine fastest = ENG_INTERP;
+        cold = &workload[i];
+        printf("%-12s", workload[i].name);
+        for (Engine e = ENG_INTERP; e <= ENG_IMAGE; ++e) {
+#ifdef IMAGE
+            const bool have = e != ENG_IMAGE || !strcmp(workload[i].file, IMAGEFILE);
+#else
+            const bool have = e != ENG_IMAGE;
+#endif
+            if (!have) {
+                printf(" %12s", "-");
+                continue;
+            }
+            engine = e;
+            r[e] = measure(wl_cold);
+            printf(" %12.0f", r[e].mean);
+            if (r[e].mean < r[fastest].mean)
+                fastest = e;
+        }
+        engine = ENG_AUTO;
+        memset(engticks, 0, sizeof engticks);
+        r[ENG_AUTO] = measure(wl_cold);
+        const Engine ran = mostran();
+        const bool flag = slower(&r[ENG_AUTO], &r[fastest]);
+        printf(" %12.0f  %-9s %-9s%s\n", r[ENG_AUTO].mean, engname[fastest], engname[ran], flag ? "  MISS" : "");
+        miss |= flag;
+    }
+    cachedir = dir;
+    clean_all();
+    return miss;
+}
+
+// Run all benchmarks, append results to the history file and compare against the baseline
+// Option "-b" also stores the results as the new baseline, "micro [name]" runs micro-benchmarks
+// and "engines" compares the engines instead
+// Returns 1 if there was a significant slowdown in this run and in the previous one, else 0
+static int bench(int argc, char *argv[])
+{
+    if (argc > 0 && !strcmp(argv[0], "micro"))
+        return micro(argc - 1, argv + 1);
+    if (argc > 0 && !strcmp(argv[0], "engines"))
+        return engines();
+    const bool save = argc > 0 && !strcmp(argv[0], "-b");
+
+    char commit[16] = "unknown";
+    FILE *git = popen("git rev-parse --short HEAD 2>/dev/null", "r");
+    if (git != NULL) {
+        if (fscanf(git, "%15s", commit) != 1)
+            strcpy(commit, "unknown");
+        pclose(git);
+    }
+    struct utsname un;
+    if (uname(&un) != 0)
+        un = (struct utsname){ .nodename = "unknown", .machine = "unknown" };
+    const long now = (long)time(NULL);
+
+    FILE *log = fopen(BENCHLOG, "a");
+    FILE *base = save ? fopen(BENCHBASE, "w") : NULL;
+    int slow = 0;
+    printf("%-12s %-8s %14s %12s %14s %8s\n", "workload", "engine", "mean (ns)", "sd", "baseline", "change");
+    for (size_t i = 0; i < workloads; ++i) {
+        load(&vm[workload[i].ref], workload[i].file);
+        memset(engticks, 0, sizeof engticks);
+        Result r = measure(workload[i].fn), b;
+        snprintf(r.workload, sizeof r.workload, "%s", workload[i].name);
+        snprintf(r.engine, sizeof r.engine, "%s", engname[mostran()]);
+        printf("%-12s %-8s %14.0f %12.0f", r.workload, r.engine, r.mean, r.sd);
+        if (!save && lookup(BENCHBASE, &r, &b)) {
+            Result prev;  // last run in the history, this one isn't in it yet
+            const bool flag = slower(&r, &b), again = flag && lookup(BENCHLOG, &r, &prev) && slower(&prev, &b);
+            printf(" %14.0f %+7.1f%%%s\n", b.mean, 100 * (r.mean / b.mean - 1), again ? "  SLOWER" : flag ? "  slower?" : "");
+            slow |= again;
+        } else
+            printf("\n");
+        for (int j = 0; j < 2; ++j) {
+            FILE *f = j ? base : log;
+            if (f != NULL)
+                fprintf(f, "%ld %s %s %s %s %s %d %.1f %.1f\n", now, commit, un.nodename, un.machine,
+                    r.workload, r.engine, r.runs, r.mean, r.sd);
+        }
+    }
+    if (log != NULL)
+        fclose(log);
+    if (base != NULL)
+        fclose(base);
+    clean_all();
+    return slow;
+}
+
+// Parameter k of instruction at address a as C expression, mode as in execute()
+static void cgenpar(const int a, const int k, const int64_t mode, const bool write)
+{
+    if (write)
+        printf("cell(pv, M[%d]%s, ERR_PAR_WRITE)", a + k, mode & REL ? " + pv->base" : "");
+    else if (mode & IMM)
+        printf("M[%d]", a + k);
+    else
+        printf("*cell(pv, M[%d]%s, ERR_PAR_READ)", a + k, mode & REL ? " + pv->base" : "");
+}
+
+// Instruction at address a that can be compiled, or NULL
+static const Lang *cgendef(const VirtualMachine *pv, const size_t a)
+{
+    const int64_t in = pv->mem[a];
+    if (in < 0)
+        return NULL;
+    const Lang *def = getdef(in % 100);
+    if (def->op != in % 100 && in % 100 != HLT)
+        return NULL;  // unknown
+    if (a + 1 + (size_t)def->pc >= pv->size)
+        return NULL;
+    return def;
+}
+
+// Compile program to a C header for a build with -DIMAGE: the image itself and
+// imagerun(), one case per address that holds a compilable instruction, with
+// decode and parameter modes folded. Each case checks that its instruction
+// is unmodified, else the interpreter takes over. I/O on the shared fifo is
+// left to the interpreter, I/O on private channels is compiled.
+static int cgen(const char *filename)
+{
+    VirtualMachine *pv = &vm[0];
+    readimage(pv, filename);
+
+    printf("// Generated by \"intcode cgen %s\", do not edit\n", filename);
+    printf("#define IMAGEFILE \"%s\"\n#define IMAGESIZE (%zu)\n#define M (pv->mem)\n\n", filename, pv->size);
+    printf("static const int64_t image[IMAGESIZE] = {");
+    for (size_t i = 0; i < pv->size; ++i)
+        printf("%s%"PRId64, !i ? "\n    " : i % 16 ? "," : ",\n    ", pv->mem[i]);
+    printf("\n};\n\n");
+
+    printf("static ImageExit imagerun(VirtualMachine *pv)\n{\n");
+    printf("    if (pv->size < IMAGESIZE)\n        return IMG_NONE;\n");
+    printf("    if (interrupted(pv) || pv->halted)\n        return IMG_DONE;\n");
+    printf("    for (;;) switch (pv->ip) {\n");
+    for (size_t a = 0; a < pv->size; ++a) {
+        const Lang *def = cgendef(pv, a);
+        if (def == NULL)
+            continue;
+        const int64_t in = pv->mem[a];
+        const int next = (int)a + 1 + def->pc;
+        int64_t mode[MAXPC] = {0};
+        for (int k = 0, m = (int)(in / 100); k < def->pc; ++k, m /= 10)
+            mode[k] = m % 10;
+
+        printf("    case %zu: L%zu: __attribute__((unused));\n", a, a);
+        printf("        if (M[%zu] != %"PRId64")\n            return IMG_STEP;\n", a, in);
+        if (def->op == INP || def->op == OUT)
+            printf("        if (pv->%s == NULL)\n            return IMG_STEP;\n", def->op == INP ? "in" : "out");
+        printf("        if (pv->limit && pv->ticks >= pv->limit) {\n            pv->ip = %zu;\n            return IMG_DONE;\n        }\n", a);
+        printf("        ++pv->ticks;\n");
+        switch (in % 100) {
+            case ADD: case MUL: case LT: case EQ: {
+                // Wrapping like the reference engine, signed overflow is undefined in C
+                static const char *expr[] = { [ADD] = "WRAPADD(x, y)", [MUL] = "WRAPMUL(x, y)", [LT] = "x < y", [EQ] = "x == y" };
+                printf("        {\n            const int64_t x = ");
+                cgenpar((int)a, 1, mode[0], false);
+                printf(", y = ");
+                cgenpar((int)a, 2, mode[1], false);
+                printf(";\n            *");
+                cgenpar((int)a, 3, mode[2], true);
+                printf(" = %s;\n        }\n", expr[in % 100]);
+                break;
+            }
+            case JNZ: case JPZ:
+                printf("        {\n            const int64_t x = ");
+                cgenpar((int)a, 1, mode[0], false);
+                printf(", y = ");
+                cgenpar((int)a, 2, mode[1], false);
+                printf(";\n            if (%sx) {\n                pv->ip = y;\n", in % 100 == JNZ ? "" : "!");
+                printf("                if (interrupted(pv))\n                    return IMG_DONE;\n");
+                printf("                if (pv->natcount) {\n                    callnative(pv);\n");
+                printf("                    if (pv->ip != y)\n                        continue;  // recognised subroutine returned\n                }\n");
+                // Jump target as in the image: direct jump
+                if (mode[1] & IMM && pv->mem[a + 2] >= 0 && (size_t)pv->mem[a + 2] < pv->size && cgendef(pv, (size_t)pv->mem[a + 2]))
+                    printf("                if (y == %"PRId64")\n                    goto L%"PRId64";\n", pv->mem[a + 2], pv->mem[a + 2]);
+                printf("                continue;\n            }\n        }\n");
+                break;
+            case INP:
+                printf("        if (!dequeue(pv->in, ");
+                cgenpar((int)a, 1, mode[0], true);
+                printf(")) {\n            --pv->ticks;\n            pv->ip = %zu;\n            return IMG_DONE;\n        }\n", a);
+                break;
+            case OUT:
+                printf("        if (!enqueue(pv->out, ");
+                cgenpar((int)a, 1, mode[0], false);
+                printf(")) {\n            --pv->ticks;\n            pv->ip = %zu;\n            return IMG_DONE;\n        }\n", a);
+                break;
+            case RBO:
+                printf("        pv->base += ");
+                cgenpar((int)a, 1, mode[0], false);
+                printf(";\n");
+                break;
+            case HLT:
+                printf("        pv->ip = %d;\n        pv->halted = true;\n        return IMG_DONE;\n", next);
+                continue;
+        }
+        printf("        pv->ip = %d;\n", next);
+        if ((size_t)next < pv->size && cgendef(pv, (size_t)next))
+            printf("        goto L%d;\n", next);
+        else
+            printf("        continue;\n");
+    }
+    printf("    default:\n        return IMG_STEP;\n    }\n}\n\n#undef M\n");
+    clean_all();
+    return 0;
+}
+
+// Run program from file, input from stdin and output to stdout
+// On the interpreter with the stdio engine that doesn't return on every output,
+// else (checked arithmetic, or another engine) through run() and the shared fifo
+// SIGINT stops the program at its next block boundary, so statistics and trace are still written
+static int runfile(const char *filename, const bool checked)
+{
+    int status = 0;
+    const bool stats = getenv("INTCODE_STATS") != NULL;
+    if (stats)
+        fifo.lat = &fifolat;
+    load(&vm[0], filename);
+    vm[0].checked = checked;
+    interruptible(killvm);
+    if (vm[0].eng == ENG_THREADED && engine == ENG_AUTO && !threadable(vm[0].img))
+        vm[0].eng = ENG_INTERP;  // decide now, I/O bound programs run best on stdio
+    if (checked || vm[0].eng != ENG_INTERP) {
+        while (!vm[0].halted) {
+            run(&vm[0]);
+            fifoprint();
+        }
+    } else {
+        running = &vm[0];
+        tier = ENG_INTERP;
+        execute_stdio(&vm[0]);
+        running = NULL;
+    }
+    if (stopped(&vm[0])) {
+        fprintf(stderr, "Interrupted at ip %zd after %"PRIu64" instructions.\n", vm[0].ip, vm[0].ticks);
+        status = 128 + SIGINT;
+    }
+    hotspots(stderr, 20);
+    if (stats) {
+        fprintf(stderr, "memory     %s, %zu cells, %zu growth events\n", memname[vm[0].back], vm[0].size, vm[0].grows);
+        memprint(stderr);
+        latprint(stderr, "fifo", &fifolat);
+    }
+    clean_all();
+    return status;
+}
+
+// Snapshot trie for serve mode: a node holds the VM state after consuming the
+// inputs on its path from the root, blocked on the next input (or halted)
+typedef struct node {
+    VirtualMachine snap;
+    int64_t val;          // input that leads here from the parent
+    int64_t *out;         // outputs produced on the way here
+    size_t outs;
+    int parent, child, next;  // tree links, -1 = none
+    uint64_t used;        // request number of last use
+} Node;
+
+static Node trie[MAXNODES];
+static int nodes = 0;
+static uint64_t requests = 0;
+
+// Run VM until it halts or blocks on input, collect outputs in a new array
+static int64_t *advance(VirtualMachine *pv, size_t *len)
+{
+    int64_t *buf = NULL, val;
+    size_t cap = 0;
+    *len = 0;
+    while (vmread(pv, &val) == VM_OUT) {
+        if (*len == cap) {
+            int64_t *try = realloc(buf, (cap = cap ? cap * 2 : 16) * sizeof *buf);
+            if (try == NULL)
+                fatal(ERR_MEM_OUT);
+            buf = try;
+        }
+        buf[(*len)++] = val;
+    }
+    return buf;
+}
+
+// New trie node for input val after parent, evicting the least recently used
+// leaf not used by this request if the trie is full; NULL if there is none
+static Node *newnode(const int parent, const int64_t val)
+{
+    int k = nodes;
+    if (nodes == MAXNODES) {
+        k = -1;
+        for (int i = 1; i < nodes; ++i)
+            if (trie[i].child < 0 && trie[i].used < requests && (k < 0 || trie[i].used < trie[k].used))
+                k = i;
+        if (k < 0)
+            return NULL;
+        int *link = &trie[trie[k].parent].child;
+        while (*link != k)
+            link = &trie[*link].next;
+        *link = trie[k].next;
+        free(trie[k].out);
+    } else
+        ++nodes;
+    Node *n = &trie[k];
+    n->val = val;
+    n->out = NULL;
+    n->outs = 0;
+    n->parent = parent;
+    n->child = -1;
+    n->next = parent >= 0 ? trie[parent].child : -1;
+    n->used = requests;
+    if (parent >= 0)
+        trie[parent].child = k;
+    return n;
+}
+
+static void forgettrie(void)
+{
+    for (int i = 0; i < nodes; ++i) {
+        clean(&trie[i].snap);
+        free(trie[i].out);
+    }
+    nodes = 0;
+}
+
+static size_t printvals(const int64_t *val, const size_t len, size_t printed)
+{
+    for (size_t i = 0; i < len; ++i)
+        printf("%s%"PRId64, printed++ ? "," : "", val[i]);
+    return printed;
+}
+
+// Run app on inputs, resuming from the deepest snapshot of a run that had the same
+// input prefix, and snapshot every input further on. Returns number of outputs printed.
+static size_t resume(VirtualMachine *app, const VirtualMachine *ref, const int64_t *input, const size_t inputs)
+{
+    size_t printed = 0, k = 0;
+    ++requests;
+    if (!nodes) {
+        Node *root = newnode(-1, 0);
+        copyvm(app, ref);
+        root->out = advance(app, &root->outs);
+        copyvm(&root->snap, app);
+        if (stopped(app))
+            return printvals(root->out, root->outs, 0);
+    }
+    int cur = 0;
+    trie[cur].used = requests;
+    printed = printvals(trie[cur].out, trie[cur].outs, printed);
+    for (int c; k < inputs; ++k, cur = c) {
+        for (c = trie[cur].child; c >= 0 && trie[c].val != input[k]; c = trie[c].next)
+            ;
+        if (c < 0)
+            break;
+        trie[c].used = requests;
+        printed = printvals(trie[c].out, trie[c].outs, printed);
+    }
+    copyvm(app, &trie[cur].snap);
+    for (; k < inputs && !app->halted && !stopped(app); ++k) {
+        size_t len;
+        reset(app->in);
+        vmwrite(app, input[k]);
+        int64_t *out = advance(app, &len);
+        printed = printvals(out, len, printed);
+        Node *n = cur >= 0 ? newnode(cur, input[k]) : NULL;
+        if (n != NULL) {
+            n->out = out;
+            n->outs = len;
+            copyvm(&n->snap, app);
+            cur = (int)(n - trie);
+        } else {
+            free(out);
+            cur = -1;  // no room: carry on without snapshots
+        }
+    }
+    return printed;
+}
+
+// Whole token as a number, false if it isn't one or out of range
+static bool number(const char *s, int64_t *val)
+{
+    char *end;
+    errno = 0;
+    *val = strtoll(s, &end, 10);
+    return end != s && *end == '\0' && errno == 0;
+}
+
+// Batch mode: load program once, then run a fresh copy for every line on stdin
+// so drivers in other languages don't start a process per run. Line format,
+// space and/or comma separated: N = input value, A=V = set memory cell A
+// before running, ?A = report memory cell A afterwards. Output is one line per
+// run: all output values comma separated, then " A=V" for every query, then
+// " blocked" if the program wanted more input than given. A line with a bad
+// token isn't run and gets "error: <reason> <token>" instead.
+// Runs without memory changes resume from a snapshot after the longest input
+// prefix they share with earlier runs, see resume().
+// SIGINT stops the current run, which then replies " interrupted" instead.
+static int serve(const char *filename)
+{
+    static Fifo in, out;
+    static Histogram inh, outh;  // their latencies, with INTCODE_STATS
+    VirtualMachine *ref = &vm[0], *app = &vm[1];
+    char *line = NULL;
+    size_t len = 0;
+
+    const bool stats = getenv("INTCODE_STATS") != NULL;
+    if (stats) {
+        in.lat  = &inh;
+        out.lat = &outh;
+    }
+    load(ref, filename);
+    interruptible(pausevm);
+    app->in  = &in;
+    app->out = &out;
+    while (getline(&line, &len, stdin) > 0) {
+        copyvm(app, ref);
+        reset(&in);
+        reset(&out);
+        int64_t query[FIFOSIZE], input[FIFOSIZE], addr, val;
+        size_t queries = 0, inputs = 0;
+        bool patched = false;
+        const char *error = NULL;
+        char *tok;
+        for (tok = strtok(line, " ,\t\r\n"); tok != NULL; tok = strtok(NULL, " ,\t\r\n")) {
+            char *eq = strchr(tok, '=');
+            if (*tok == '?') {
+                if (!number(tok + 1, &addr) || addr < 0 || addr >= MAXCELL)
+                    error = "bad address";
+                else if (queries == FIFOSIZE)
+                    error = "too many queries";
+                else
+                    query[queries++] = addr;
+            } else if (eq != NULL) {
+                *eq = '\0';
+                if (!number(tok, &addr) || addr < 0 || addr >= MAXCELL)
+                    error = "bad address";
+                else if (!number(eq + 1, &val))
+                    error = "bad value";
+                else {
+                    *cell(app, addr, ERR_PAR_WRITE) = val;
+                    patched = true;
+                }
+                *eq = '=';
+            } else if (!number(tok, &val))
+                error = "bad input";
+            else if (inputs == FIFOSIZE - 1)
+                error = "too many inputs";
+            else
+                input[inputs++] = val;
+            if (error != NULL)
+                break;
+        }
+        if (error != NULL) {
+            printf("error: %s %s\n", error, tok);  // and don't run
+            fflush(stdout);
+            continue;
+        }
+        size_t printed = 0;
+        if (!patched)
+            printed = resume(app, ref, input, inputs);
+        else {
+            int64_t val;
+            for (size_t i = 0; i < inputs; ++i)
+                vmwrite(app, input[i]);
+            while (vmread(app, &val) == VM_OUT)
+                printed = printvals(&val, 1, printed);
+        }
+        for (size_t i = 0; i < queries; ++i)
+            printf(" %"PRId64"=%"PRId64, query[i], (size_t)query[i] < app->size ? app->mem[query[i]] : 0);
+        if (stopped(app))
+            forgettrie();  // snapshots of this run may be mid-way
+        printf("%s\n", stopped(app) ? " interrupted" : app->halted ? "" : " blocked");
+        fflush(stdout);
+    }
+    free(line);
+    forgettrie();
+    hotspots(stderr, 20);
+    if (stats) {
+        memprint(stderr);
+        latprint(stderr, "in", &inh);
+        latprint(stderr, "out", &outh);
+    }
+    clean_all();
+    return 0;
+}
+
+// Partial evaluation: run program on the known inputs (comma separated) until it needs
+// the first unknown one, then print a residual Intcode program that starts where it
+// stopped. The residual program first outputs what was output so far, sets the relative
+// base and jumps to the current ip. It lives in cells 0-2 (restored before the jump)
+// and past the end of memory as it was at that point.
+static int residual(const char *filename, char *inputs)
+{
+    static Fifo in, out;
+    VirtualMachine *pv = &vm[0];
+
+    load(pv, filename);
+    setsize(pv, 3);  // room for the entry jump
+    pv->in  = &in;
+    pv->out = &out;
+    for (char *tok = strtok(inputs, ","); tok != NULL; tok = strtok(NULL, ","))
+        enqueue(&in, strtoll(tok, NULL, 10));
+    size_t outs;
+    int64_t *val = advance(pv, &outs);
+
+    // Prelude
+    int64_t pre[2 * outs + 2 + 3 * 4 + 4];
+    size_t n = 0;
+    for (size_t i = 0; i < outs; ++i) {
+        pre[n++] = 104;  // OUT immediate
+        pre[n++] = val[i];
+    }
+    free(val);
+    if (pv->halted)
+        pre[n++] = HLT;
+    else {
+        if (pv->base) {
+            pre[n++] = 109;  // RBO immediate
+            pre[n++] = pv->base;
+        }
+        for (int i = 0; i < 3; ++i) {
+            pre[n++] = 1101;  // ADD immediate, immediate -> positional
+            pre[n++] = 0;
+            pre[n++] = pv->mem[i];
+            pre[n++] = i;
+        }
+        pre[n++] = 1105;  // JNZ immediate, immediate
+        pre[n++] = 1;
+        pre[n++] = pv->ip;
+        pre[n++] = 0;  // execute() wants a cell after the last parameter
+    }
+
+    if (pv->halted) {
+        // Nothing left to do but the outputs
+        for (size_t i = 0; i < n; ++i)
+            printf("%s%"PRId64, i ? "," : "", pre[i]);
+    } else {
+        printf("1105,1,%zu", pv->size);
+        for (size_t i = 3; i < pv->size; ++i)
+            printf(",%"PRId64, pv->mem[i]);
+        for (size_t i = 0; i < n; ++i)
+            printf(",%"PRId64, pre[i]);
+    }
+    printf("\n");
+    fprintf(stderr, "Residual program: %zu outputs folded, %"PRIu64" instructions skipped%s\n",
+        outs, pv->ticks, pv->halted ? ", halted" : "");
+    clean_all();
+    return 0;
+}
+
+// Debugger: load program with the known inputs (comma separated) and read commands
+// from stdin, one per line:
+//   b A   set a breakpoint at address A
+//   c     continue until a breakpoint, halt or the next missing input
+//   t N   go back (or forward) to the state after N instructions
+//   s     step back one instruction
+//   w A   go back to just before the last instruction that changed cell A
+//   ?A    print cell A
+// Every command replies with one line: instructions executed, ip, relative base,
+// the outputs so far and why the VM stopped, or "no" if it couldn't do that.
+static int debug(const char *filename, char *inputs)
+{
+    static Fifo in, out;
+    static History h;
+    VirtualMachine *pv = &vm[0];
+    char *line = NULL;
+    size_t len = 0;
+
+    load(pv, filename);
+    pv->in  = &in;
+    pv->out = &out;
+    for (char *tok = strtok(inputs, ","); tok != NULL; tok = strtok(NULL, ","))
+        enqueue(&in, strtoll(tok, NULL, 10));
+    checkpoint(&h, pv);
+    while (getline(&line, &len, stdin) > 0) {
+        const int64_t arg = strtoll(line + 1, NULL, 10);
+        size_t brk[MAXBRK];
+        const size_t brkcount = pv->brkcount;
+        memcpy(brk, pv->brk, sizeof brk);
+        bool ok = true;
+        switch (*line) {
+            case 'b': ok = arg >= 0 && codeat(pv, (size_t)arg) && setbreak(pv, (size_t)arg); break;
+            case 'c':
+                if (pv->ip >= 0 && isbreak(pv, (size_t)pv->ip))
+                    pv->trap = (size_t)pv->ip + 1;  // continue past the breakpoint it's at
+                record(pv, &h);
+                break;
+            case 't': ok = arg >= 0 && travel(pv, &h, (uint64_t)arg); break;
+            case 's': ok = stepback(pv, &h);                     break;
+            case 'w': ok = arg >= 0 && lastchange(pv, &h, (size_t)arg); break;
+            case '?':
+                printf("%"PRId64"=%"PRId64"\n", arg, arg < 0 || (size_t)arg >= pv->size ? 0 : pv->mem[arg]);
+                continue;
+            default: continue;
+        }
+        for (size_t i = 0; i < brkcount; ++i)  // checkpoints from before they were set don't have them
+            setbreak(pv, brk[i]);
+        printf("%"PRIu64" ip=%zd base=%zd out=", pv->ticks, pv->ip, pv->base);
+        for (size_t i = out.tail; i != out.head; i = (i + 1) % FIFOSIZE)
+            printf("%s%"PRId64, i != out.tail ? "," : "", out.buf[i]);
+        printf(" %s\n", !ok ? "no" : *line == 'c' ? stopreason(pv) : "ok");
+        fflush(stdout);
+    }
+    free(line);
+    forget(&h);
+    clean_all();
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    // Native subroutines: "0" to always interpret, "verify" to check every call
+    const char *nat = getenv("INTCODE_NATIVE");
+    if (nat != NULL)
+        nativemode = !strcmp(nat, "0") ? NAT_OFF : !strcmp(nat, "verify") ? NAT_VERIFY : NAT_ON;
+
+    // Optional cache directory for decoded programs
+    cachedir = getenv("INTCODE_CACHE");
+
+    // Optional timeline of VM events
+    const char *tracefile = getenv("INTCODE_TRACE");
+    if (tracefile != NULL)
+        traceopen(tracefile);
+
+    // Engine override: -e auto|interp|threaded|image (image only in a build with one)
+    if (argc > 2 && !strcmp(argv[1], "-e")) {
+        size_t i = 0;
+        while (i < sizeof engname / sizeof *engname && strcmp(argv[2], engname[i]))
+            ++i;
+#ifndef IMAGE
+        if (i == ENG_IMAGE)
+            fatal(ERR_ENGINE);
+#endif
+        if (i == sizeof engname / sizeof *engname)
+            fatal(ERR_ENGINE);
+        engine = (Engine)i;
+        argc -= 2;
+        argv += 2;
+    }
+
+    // Optional sampling profiler, value is the interval in microseconds
+    const char *prof = getenv("INTCODE_PROFILE");
+    if (prof != NULL)
+        profile(atol(prof) > 0 ? atol(prof) : 1000);
+
+    if (argc > 1 && !strcmp(argv[1], "bench"))
+        return bench(argc - 2, argv + 2);
+    if (argc > 3 && !strcmp(argv[1], "run") && !strcmp(argv[2], "-c"))
+        return runfile(argv[3], true);
+    if (argc > 2 && !strcmp(argv[1], "run"))
+        return runfile(argv[2], false);
+    if (argc > 2 && !strcmp(argv[1], "serve"))
+        return serve(argv[2]);
+    if (argc > 2 && !strcmp(argv[1], "residual")) {
+        char none[] = "";
+        return residual(argv[2], argc > 3 ? argv[3] : none);
+    }
+    if (argc > 2 && !strcmp(argv[1], "cgen"))
+        return cgen(argv[2]);
+    if (argc > 2 && !strcmp(argv[1], "debug")) {
+        char none[] = "";
+        return debug(argv[2], argc > 3 ? argv[3] : none);
+    }
+
+    VirtualMachine *ref, *app;
+
+    // Optional I/O latency statistics
+    const bool stats = getenv("INTCODE_STATS") != NULL;
+    if (stats) {
+        fifo.lat = &fifolat;
+        for (int i = 0; i < STAGES; ++i) {
+            inbox[i].lat  = &inlat[i];
+            outbox[i].lat = &outlat[i];
+        }
+    }
+
+    // Day 2 part 1
+    ref = &vm[0];
+    app = &vm[1];
+    load(ref, "input02.txt");  // load data into last VM, amps are numbered 0..STAGES-1
+    copyvm(app, ref);
+    app->mem[1] = 12;
+    app->mem[2] = 2;
+    run(app);
+    printf("Day 2 part 1: %"PRId64"\n", app->mem[0]);  // right answer = 3085697
+
+    // Day 2 part 2
+    printf("Day 2 part 2: %d\n", day2part2(app, ref));  // right answer = 9425
+
+    // Day 7
+    ref = &vm[STAGES];
+    load(ref, "input07.txt");  // load data into last VM, amps are numbered 0..STAGES-1
+    printf("Day 7 part 1: %"PRId64"\n", maxamp(1));  // right answer = 929800
+    printf("Day 7 part 2: %"PRId64"\n", maxamp(2));  // right answer = 15432220
+
+    // Day 9 part 1
+    ref = &vm[0];
+    app = &vm[1];
+    load(ref, "input09.txt");
+    copyvm(app, ref);
+    fifo_push(1);
+    run(app);
+    printf("Day 9 part 1: %"PRId64"\n", fifo_pop());  // right answer = 4261108180
+
+    // Day 9 part 2
+    copyvm(app, ref);
+    fifo_push(2);
+    run(app);
+    printf("Day 9 part 2: %"PRId64"\n", fifo_pop());  // right answer = 77944
+
+    hotspots(stderr, 20);
+    if (stats) {
+        memprint(stderr);
+        latprint(stderr, "fifo", &fifolat);
+        for (int i = 0; i < STAGES; ++i) {
+            char name[16];
+            snprintf(name, sizeof name, "amp%d.in", i);
+            latprint(stderr, name, &inlat[i]);
+            snprintf(name, sizeof name, "amp%d.out", i);
+            latprint(stderr, name, &outlat[i]);
+        }
+    }
     clean_all();
     return 0;
 }